@@ -32,6 +32,14 @@
 
 #define GET_TAG_CC(tag)         (tag & 0x00ff)
 
+// Synth board SysEx (see SysExBuffer.h in the synth source)
+#define SYSEX_MANUFACTURER_ID   0x7d
+#define SYSEX_STORE_PATCH       0x06
+#define SYSEX_RECALL_PATCH      0x07
+
+// Number keys play notes from C2 upwards
+#define FIRST_KEY_NOTE          36
+
 #define TAG_KEY_LOAD        KEY_TAG('L')
 #define TAG_KEY_SAVE        KEY_TAG('S')
 #define TAG_KEY_NUMBER_1    KEY_TAG(1)
@@ -435,7 +443,26 @@ void TestLoop()
     }
 }
 
-int testOctave = 3;
+// One bit per number key which has sent a note on, so that its note off is
+// sent even if Load or Save is pressed before the key is released
+uint16_t keysPlaying = 0;
+
+// Load and Save are held down while pressing a number key to recall or store
+// the current channel's patch in that slot
+bool loadHeld = false;
+bool saveHeld = false;
+
+void sendPatchRequest(uint8_t command, uint8_t slot)
+{
+    uint8_t data[4] = {
+        SYSEX_MANUFACTURER_ID,
+        command,
+        (uint8_t)(midiChannel - 1),
+        slot
+    };
+
+    MIDI.sendSysEx(sizeof(data), data);
+}
 
 void MainLoop()
 {
@@ -457,8 +484,8 @@ void MainLoop()
             } else if (IS_CC_SWITCH_TAG(control->getTagData())) {
                 MIDI.sendControlChange(GET_TAG_CC(control->getTagData()), control->value() ? 0x7f: 0x00, midiChannel);
             } else if (IS_KEY_TAG(control->getTagData())) {
-                // Test stuff (for now)
-                // Number keys play notes, load/save change octave
+                // Number keys play notes, or recall/store patches while
+                // Load or Save is held
 
                 uint8_t note = 0;
                 bool sendMidi = true;
@@ -530,24 +557,28 @@ void MainLoop()
                         break;
                     case TAG_KEY_LOAD:
                         sendMidi = false;
-                        if (control->value()) {
-                            ++ testOctave;
-                        }
+                        loadHeld = control->value();
                         break;
                     case TAG_KEY_SAVE:
                         sendMidi = false;
-                        if (control->value()) {
-                            -- testOctave;
-                        }
+                        saveHeld = control->value();
                         break;
                 }
-                
-                note += testOctave * 12;
+
                 if (sendMidi) {
-                    if (control->value()) {
-                        MIDI.sendNoteOn(note, 0x7f, 1);
+                    uint16_t keyBit = 1 << note;
+
+                    if (!control->value()) {
+                        if (keysPlaying & keyBit) {
+                            keysPlaying &= ~keyBit;
+                            MIDI.sendNoteOff(FIRST_KEY_NOTE + note, 0x7f, 1);
+                        }
+                    } else if ((loadHeld) || (saveHeld)) {
+                        // Number key pressed with Load or Save, note is the slot
+                        sendPatchRequest(saveHeld ? SYSEX_STORE_PATCH : SYSEX_RECALL_PATCH, note);
                     } else {
-                        MIDI.sendNoteOff(note, 0x7f, 1);
+                        keysPlaying |= keyBit;
+                        MIDI.sendNoteOn(FIRST_KEY_NOTE + note, 0x7f, 1);
                     }
                 }
             }
@@ -19,12 +19,9 @@
 #include <SPI.h>
 #include "ISABus.h"
 #include "ISRState.h"
+#include "Profiler.h"
 
 #define USE_SPI         1
-#define ISA_IOR_DELAY   10
-#define ISA_IOW_DELAY   10
-#define ISA_PRE_DELAY   10
-#define ISA_POST_DELAY  10
 #define DO_LSB          1
 
 ISABus::ISABus(
@@ -39,7 +36,8 @@ ISABus::ISABus(
 : m_outputPin(outputPin), m_inputPin(inputPin),
   m_clockPin(clockPin), m_latchPin(latchPin),
   m_loadPin(loadPin), m_ioWritePin(ioWritePin),
-  m_ioReadPin(ioReadPin), m_resetPin(resetPin)
+  m_ioReadPin(ioReadPin), m_resetPin(resetPin),
+  m_batching(false)
 {
 }
 
@@ -76,6 +74,8 @@ void ISABus::write(
     uint16_t address,
     uint8_t data) const
 {
+    PROFILE_SCOPE(ProfileISABusWrite);
+
 #ifdef PRINT_IO
     Serial.print("OUT 0x");
     Serial.print(address, HEX);
@@ -87,12 +87,16 @@ void ISABus::write(
         //noInterrupts();
     }
 
-    // Put the data shift register into 'shift' mode
-    digitalWrite(m_loadPin, LOW);
+    if (!m_batching) {
+        // Put the data shift register into 'shift' mode
+        digitalWrite(m_loadPin, LOW);
 
 #ifdef USE_SPI
-    SPI.beginTransaction(SPISettings(14000000, LSBFIRST, SPI_MODE0));
+        SPI.beginTransaction(SPISettings(ISA_SPI_CLOCK, LSBFIRST, SPI_MODE0));
+#endif
+    }
 
+#ifdef USE_SPI
     SPI.transfer(data);
     //SPI.transfer16(address);
     SPI.transfer(address & 0xff);
@@ -123,13 +127,15 @@ void ISABus::write(
 
     // Lower the IOW pin on the ISA bus to indicate we're writing data
     digitalWrite(m_ioWritePin, LOW);
-    delayMicroseconds(ISA_IOR_DELAY);
+    delayMicroseconds(ISA_IOW_DELAY);
     digitalWrite(m_ioWritePin, HIGH);
 
     delayMicroseconds(ISA_POST_DELAY);
 
 #ifdef USE_SPI
-    SPI.endTransaction();
+    if (!m_batching) {
+        SPI.endTransaction();
+    }
 #endif
 
     if (!inISR()) {
@@ -137,6 +143,27 @@ void ISABus::write(
     }
 }
 
+void ISABus::beginBatch() const
+{
+    // Put the data shift register into 'shift' mode
+    digitalWrite(m_loadPin, LOW);
+
+#ifdef USE_SPI
+    SPI.beginTransaction(SPISettings(ISA_SPI_CLOCK, LSBFIRST, SPI_MODE0));
+#endif
+
+    m_batching = true;
+}
+
+void ISABus::endBatch() const
+{
+#ifdef USE_SPI
+    SPI.endTransaction();
+#endif
+
+    m_batching = false;
+}
+
 uint8_t ISABus::read(
     uint16_t address) const
 {
@@ -153,7 +180,7 @@ uint8_t ISABus::read(
     }
 
 #ifdef USE_SPI
-    SPI.beginTransaction(SPISettings(14000000, LSBFIRST, SPI_MODE0));
+    SPI.beginTransaction(SPISettings(ISA_SPI_CLOCK, LSBFIRST, SPI_MODE0));
 
     SPI.transfer(address & 0xff);
     SPI.transfer((address & 0xff00) >> 8);
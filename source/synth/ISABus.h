@@ -42,6 +42,16 @@
 
 #include <stdint.h>
 
+// Timing (in microseconds) of each ISA bus cycle. These are shared with the
+// simulated ISA bus so that it can predict how long the real one would take.
+#define ISA_IOR_DELAY   10
+#define ISA_IOW_DELAY   10
+#define ISA_PRE_DELAY   10
+#define ISA_POST_DELAY  10
+
+// Requested SPI clock. On a 16MHz AVR this is limited to 8MHz.
+#define ISA_SPI_CLOCK   14000000
+
 #ifndef ARDUINO
     // Not compiling for embedded use - use simulated ISA bus
     #include "prototype/ISABus.h"
@@ -67,6 +77,12 @@ class ISABus {
         uint8_t read(
             uint16_t address) const;
 
+        // Writes made between these share a single SPI transaction. Reads
+        // must not be made until the batch has ended.
+        void beginBatch() const;
+
+        void endBatch() const;
+
     private:
         unsigned m_outputPin    : 4;
         unsigned m_inputPin     : 4;
@@ -76,6 +92,8 @@ class ISABus {
         unsigned m_ioWritePin   : 4;
         unsigned m_ioReadPin    : 4;
         unsigned m_resetPin     : 4;
+
+        mutable unsigned m_batching : 1;
 };
 #endif
 
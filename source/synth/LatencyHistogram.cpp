@@ -0,0 +1,193 @@
+/*
+    Project:    Canyon
+    Purpose:    Note-on latency measurement
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+*/
+
+#ifdef ARDUINO
+    #include <arduino.h>
+#else
+    #include "prototype/Timing.h"
+#endif
+
+#include "LatencyHistogram.h"
+
+LatencyHistogram::LatencyHistogram()
+: m_pendingWriteIndex(0),
+  m_pendingReadIndex(0),
+  m_active(false),
+  m_startMicros(0),
+  m_dispatchMicros(0)
+{
+    clear();
+}
+
+void LatencyHistogram::received(
+    uint8_t channel,
+    uint8_t note,
+    unsigned long startMicros)
+{
+    uint8_t nextIndex = (m_pendingWriteIndex + 1) % LATENCY_PENDING_SIZE;
+
+    if (nextIndex == m_pendingReadIndex) {
+        // Too many waiting - this one won't be measured
+        return;
+    }
+
+    m_pending[m_pendingWriteIndex].startMicros = startMicros;
+    m_pending[m_pendingWriteIndex].channel = channel;
+    m_pending[m_pendingWriteIndex].note = note;
+
+    m_pendingWriteIndex = nextIndex;
+}
+
+void LatencyHistogram::beginNoteOn(
+    uint8_t channel,
+    uint8_t note)
+{
+    unsigned long now = micros();
+    uint8_t index = m_pendingReadIndex;
+    uint8_t writeIndex = m_pendingWriteIndex;
+
+    m_active = false;
+
+    while (index != writeIndex) {
+        volatile PendingNoteOn &pending = m_pending[index];
+
+        index = (index + 1) % LATENCY_PENDING_SIZE;
+
+        if ((pending.channel == channel) && (pending.note == note)) {
+            m_active = true;
+            m_startMicros = pending.startMicros;
+            m_dispatchMicros = now;
+            break;
+        }
+    }
+
+    if (!m_active) {
+        // Not received by us (or already discarded), so leave the queue
+        // as it is - unless it is full of notes that will never be matched
+        if ((writeIndex + 1) % LATENCY_PENDING_SIZE == m_pendingReadIndex) {
+            m_pendingReadIndex = writeIndex;
+        }
+
+        return;
+    }
+
+    // Anything before the match was lost along the way
+    m_pendingReadIndex = index;
+
+    record(LatencyQueued, now - m_startMicros);
+}
+
+void LatencyHistogram::endNoteOn()
+{
+    // If there was no key-on then the note wasn't played (e.g. no free
+    // channels) and isn't counted
+    m_active = false;
+}
+
+void LatencyHistogram::keyOn()
+{
+    unsigned long now;
+
+    if (!m_active) {
+        return;
+    }
+
+    now = micros();
+    m_active = false;
+
+    record(LatencyHandling, now - m_dispatchMicros);
+    record(LatencyTotal, now - m_startMicros);
+}
+
+void LatencyHistogram::clear()
+{
+    for (uint8_t stage = 0; stage < NumberOfLatencyStages; ++ stage) {
+        for (uint8_t bucket = 0; bucket < LATENCY_BUCKETS; ++ bucket) {
+            m_counts[stage][bucket] = 0;
+        }
+
+        m_max[stage] = 0;
+    }
+}
+
+uint16_t LatencyHistogram::getCount(
+    LatencyStage stage,
+    uint8_t bucket) const
+{
+    if ((stage >= NumberOfLatencyStages) || (bucket >= LATENCY_BUCKETS)) {
+        return 0;
+    }
+
+    return m_counts[stage][bucket];
+}
+
+unsigned long LatencyHistogram::getMax(
+    LatencyStage stage) const
+{
+    if (stage >= NumberOfLatencyStages) {
+        return 0;
+    }
+
+    return m_max[stage];
+}
+
+#ifdef ARDUINO
+void LatencyHistogram::dump(
+    Print &output)
+{
+    output.println(F("Note on latency (us)"));
+    output.println(F("<\tqueued\thandle\ttotal"));
+
+    for (uint8_t bucket = 0; bucket < LATENCY_BUCKETS; ++ bucket) {
+        if (bucket < LATENCY_BUCKETS - 1) {
+            output.print(1UL << bucket);
+        } else {
+            output.print(F("more"));
+        }
+
+        for (uint8_t stage = 0; stage < NumberOfLatencyStages; ++ stage) {
+            output.print('\t');
+            output.print(m_counts[stage][bucket]);
+        }
+
+        output.println();
+    }
+
+    output.print(F("max"));
+
+    for (uint8_t stage = 0; stage < NumberOfLatencyStages; ++ stage) {
+        output.print('\t');
+        output.print(m_max[stage]);
+    }
+
+    output.println();
+
+    clear();
+}
+#endif
+
+void LatencyHistogram::record(
+    LatencyStage stage,
+    unsigned long latency)
+{
+    uint8_t bucket = 0;
+
+    // Number of significant bits, so 0 goes in bucket 0, 1 in bucket 1, 2-3
+    // in bucket 2 and so on
+    while ((latency >> bucket) && (bucket < LATENCY_BUCKETS - 1)) {
+        ++ bucket;
+    }
+
+    if (m_counts[stage][bucket] < 0xffff) {
+        ++ m_counts[stage][bucket];
+    }
+
+    if (latency > m_max[stage]) {
+        m_max[stage] = latency;
+    }
+}
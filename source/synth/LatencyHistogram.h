@@ -0,0 +1,104 @@
+/*
+    Project:    Canyon
+    Purpose:    Note-on latency measurement
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    Measures how long note-on messages take to be heard, from the first byte
+    of the message being received to the key-on being written to the OPL3.
+    This is split into the time spent waiting in the MIDI buffer (queued) and
+    the time spent handling the note (frequency calculation, operator set up
+    and ISA bus writes).
+
+    Each is accumulated in a histogram of power-of-two buckets (in
+    microseconds), along with the maximum seen. Bucket n holds latencies of
+    at least 2^(n-1) and less than 2^n microseconds, with the last bucket
+    holding anything longer.
+
+    Received note-ons are matched up with the ones being played by their
+    channel and note, so any messages dropped along the way are skipped.
+*/
+
+#ifndef CANYON_LATENCYHISTOGRAM_H
+#define CANYON_LATENCYHISTOGRAM_H 1
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+    class Print;
+#endif
+
+#define LATENCY_BUCKETS         16
+#define LATENCY_PENDING_SIZE    8
+
+typedef enum {
+    LatencyQueued   = 0,    // Received until taken from the MIDI buffer
+    LatencyHandling = 1,    // Taken from the MIDI buffer until key-on
+    LatencyTotal    = 2,    // Received until key-on
+
+    NumberOfLatencyStages
+} LatencyStage;
+
+class LatencyHistogram {
+    public:
+        LatencyHistogram();
+
+        // A complete note-on message has been received, the first byte of
+        // which arrived at the time given. This may be called from an ISR.
+        void received(
+            uint8_t channel,
+            uint8_t note,
+            unsigned long startMicros);
+
+        // These surround MIDIControl::playNote
+        void beginNoteOn(
+            uint8_t channel,
+            uint8_t note);
+
+        void endNoteOn();
+
+        // Call from OPL3::Hardware's key-on handler
+        void keyOn();
+
+        void clear();
+
+        uint16_t getCount(
+            LatencyStage stage,
+            uint8_t bucket) const;
+
+        unsigned long getMax(
+            LatencyStage stage) const;
+
+#ifdef ARDUINO
+        // Outputs the histograms as text, then clears them
+        void dump(
+            Print &output);
+#endif
+
+    private:
+        void record(
+            LatencyStage stage,
+            unsigned long latency);
+
+        typedef struct PendingNoteOn {
+            unsigned long startMicros;
+            uint8_t channel;
+            uint8_t note;
+        } PendingNoteOn;
+
+        // Written by received() and read by beginNoteOn()
+        volatile PendingNoteOn m_pending[LATENCY_PENDING_SIZE];
+        volatile uint8_t m_pendingWriteIndex;
+        volatile uint8_t m_pendingReadIndex;
+
+        // The note-on currently being played
+        unsigned m_active   : 1;
+        unsigned long m_startMicros;
+        unsigned long m_dispatchMicros;
+
+        uint16_t m_counts[NumberOfLatencyStages][LATENCY_BUCKETS];
+        unsigned long m_max[NumberOfLatencyStages];
+};
+
+#endif
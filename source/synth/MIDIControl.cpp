@@ -8,30 +8,264 @@
 
 #ifdef ARDUINO
     #include <arduino.h>
+    #include <avr/pgmspace.h>
 #else
     #include <cstddef>
+    #include <string.h>
+    #include "prototype/Timing.h"
 #endif
 #include "MIDIControl.h"
 #include "freq.h"
+#include "level.h"
+#include "Profiler.h"
 
+#ifndef ARDUINO
+    #define PROGMEM
+#endif
+
+// Only visits the note slots in use by the MIDI channel, and stops as soon as
+// there are no more
 #define FOR_EACH_PLAYING_NOTE(channel, slot, code) \
-    for (int slot##index = 0; slot##index < OPL3::NumberOfChannels; ++ slot##index) { \
-        NoteData &slot = m_playingNotes[slot##index]; \
-        if ((channel == slot.midiChannel) && (slot.opl3Channel != UnusedOpl3Channel)) { \
+    for (NoteMask slot##mask = m_channelNotes[channel], slot##index = 0; slot##mask; slot##mask >>= 1, ++ slot##index) { \
+        if (slot##mask & 1) { \
+            NoteData &slot = m_playingNotes[slot##index]; \
             code; \
         } \
     }
 
+// What a controller changes
+typedef enum {
+    ControllerIgnored = 0,
+
+    // Global
+    ControllerTremoloDepth,
+    ControllerVibratoDepth,
+
+    // Channel
+    ControllerVolume,
+    ControllerChannelType,
+    ControllerPanning,
+    ControllerLFOStartDelay,
+    ControllerReservedVoices,
+    ControllerMaxVoices,
+    ControllerFeedbackModulationFactor,
+    ControllerSustainPedal,
+    ControllerSostenutoPedal,
+    ControllerSoftPedal,
+    ControllerPortamento,
+    ControllerPortamentoTime,
+    ControllerMonoMode,
+    ControllerUnisonVoices,
+    ControllerUnisonDetune,
+    ControllerUnisonSpread,
+    ControllerPolyMode,
+    ControllerAllSoundOff,
+    ControllerResetAll,
+    ControllerAllNotesOff,
+
+    // Operator
+    ControllerWaveform,
+    ControllerAttackRate,
+    ControllerDecayRate,
+    ControllerSustainLevel,
+    ControllerReleaseRate,
+    ControllerKeyScaleLevel,
+    ControllerEnvelopeScaling,
+    ControllerFrequencyMultiplicationFactor,
+    ControllerTremolo,
+    ControllerVibrato,
+    ControllerLevel,            // These three only affect the attenuation
+    ControllerVelocityToLevel,  // and are applied by service()
+} ControllerTarget;
+
+// When a controller is applied
+typedef enum {
+    ControllerImmediate = 0,    // Only stores the value, so is cheap
+    ControllerCoalesced = 1,    // By service(), using the latest value
+    ControllerOrdered   = 2     // Immediately, after any coalesced ones
+} ControllerTiming;
+
+typedef struct __attribute__((packed)) ControllerDescriptor {
+    uint8_t target;             // ControllerTarget
+    unsigned operatorIndex  : 2;
+    unsigned shift          : 3;    // Value is shifted right by this
+    unsigned inverted       : 1;    // then subtracted from 15 (for rates)
+    unsigned timing         : 2;    // ControllerTiming
+} ControllerDescriptor;
+
+// Indexed by controller number (see doc/MIDI CC Assignments.txt)
+const PROGMEM static ControllerDescriptor controllerTable[128] = {
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 0
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 1
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 2
+    {ControllerReservedVoices, 0, 3, false, ControllerImmediate}, // 3
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 4
+    {ControllerPortamentoTime, 0, 0, false, ControllerImmediate}, // 5
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 6
+    {ControllerVolume, 0, 1, false, ControllerImmediate}, // 7
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 8
+    {ControllerChannelType, 0, 0, false, ControllerOrdered}, // 9
+    {ControllerPanning, 0, 0, false, ControllerCoalesced}, // 10
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 11
+    {ControllerLFOStartDelay, 0, 3, false, ControllerImmediate}, // 12
+    {ControllerMaxVoices, 0, 2, false, ControllerImmediate}, // 13
+    {ControllerVelocityToLevel, 0, 1, false, ControllerImmediate}, // 14
+    {ControllerVelocityToLevel, 1, 1, false, ControllerImmediate}, // 15
+    {ControllerVelocityToLevel, 2, 1, false, ControllerImmediate}, // 16
+    {ControllerVelocityToLevel, 3, 1, false, ControllerImmediate}, // 17
+    {ControllerWaveform, 0, 4, false, ControllerCoalesced}, // 18
+    {ControllerWaveform, 1, 4, false, ControllerCoalesced}, // 19
+    {ControllerWaveform, 2, 4, false, ControllerCoalesced}, // 20
+    {ControllerWaveform, 3, 4, false, ControllerCoalesced}, // 21
+    {ControllerTremoloDepth, 0, 6, false, ControllerCoalesced}, // 22
+    {ControllerTremolo, 0, 6, false, ControllerCoalesced}, // 23
+    {ControllerTremolo, 1, 6, false, ControllerCoalesced}, // 24
+    {ControllerTremolo, 2, 6, false, ControllerCoalesced}, // 25
+    {ControllerTremolo, 3, 6, false, ControllerCoalesced}, // 26
+    {ControllerVibratoDepth, 0, 6, false, ControllerCoalesced}, // 27
+    {ControllerVibrato, 0, 6, false, ControllerCoalesced}, // 28
+    {ControllerVibrato, 1, 6, false, ControllerCoalesced}, // 29
+    {ControllerVibrato, 2, 6, false, ControllerCoalesced}, // 30
+    {ControllerVibrato, 3, 6, false, ControllerCoalesced}, // 31
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 32
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 33
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 34
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 35
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 36
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 37
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 38
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 39
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 40
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 41
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 42
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 43
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 44
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 45
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 46
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 47
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 48
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 49
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 50
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 51
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 52
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 53
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 54
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 55
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 56
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 57
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 58
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 59
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 60
+    {ControllerUnisonVoices, 0, 5, false, ControllerImmediate}, // 61
+    {ControllerUnisonDetune, 0, 2, false, ControllerImmediate}, // 62
+    {ControllerUnisonSpread, 0, 6, false, ControllerImmediate}, // 63
+    {ControllerSustainPedal, 0, 6, false, ControllerOrdered}, // 64
+    {ControllerPortamento, 0, 6, false, ControllerImmediate}, // 65
+    {ControllerSostenutoPedal, 0, 6, false, ControllerOrdered}, // 66
+    {ControllerSoftPedal, 0, 6, false, ControllerImmediate}, // 67
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 68
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 69
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 70
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 71
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 72
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 73
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 74
+    {ControllerFrequencyMultiplicationFactor, 0, 3, false, ControllerCoalesced}, // 75
+    {ControllerFrequencyMultiplicationFactor, 1, 3, false, ControllerCoalesced}, // 76
+    {ControllerFrequencyMultiplicationFactor, 2, 3, false, ControllerCoalesced}, // 77
+    {ControllerFrequencyMultiplicationFactor, 3, 3, false, ControllerCoalesced}, // 78
+    {ControllerFeedbackModulationFactor, 0, 4, false, ControllerCoalesced}, // 79
+    {ControllerEnvelopeScaling, 0, 6, false, ControllerCoalesced}, // 80
+    {ControllerEnvelopeScaling, 1, 6, false, ControllerCoalesced}, // 81
+    {ControllerEnvelopeScaling, 2, 6, false, ControllerCoalesced}, // 82
+    {ControllerEnvelopeScaling, 3, 6, false, ControllerCoalesced}, // 83
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 84
+    {ControllerLevel, 0, 1, false, ControllerImmediate}, // 85
+    {ControllerAttackRate, 0, 3, true, ControllerCoalesced}, // 86
+    {ControllerDecayRate, 0, 3, true, ControllerCoalesced}, // 87
+    {ControllerSustainLevel, 0, 3, true, ControllerCoalesced}, // 88
+    {ControllerReleaseRate, 0, 3, true, ControllerCoalesced}, // 89
+    {ControllerKeyScaleLevel, 0, 5, false, ControllerCoalesced}, // 90
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 91
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 92
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 93
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 94
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 95
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 96
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 97
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 98
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 99
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 100
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 101
+    {ControllerLevel, 1, 1, false, ControllerImmediate}, // 102
+    {ControllerAttackRate, 1, 3, true, ControllerCoalesced}, // 103
+    {ControllerDecayRate, 1, 3, true, ControllerCoalesced}, // 104
+    {ControllerSustainLevel, 1, 3, true, ControllerCoalesced}, // 105
+    {ControllerReleaseRate, 1, 3, true, ControllerCoalesced}, // 106
+    {ControllerKeyScaleLevel, 1, 5, false, ControllerCoalesced}, // 107
+    {ControllerLevel, 2, 1, false, ControllerImmediate}, // 108
+    {ControllerAttackRate, 2, 3, true, ControllerCoalesced}, // 109
+    {ControllerDecayRate, 2, 3, true, ControllerCoalesced}, // 110
+    {ControllerSustainLevel, 2, 3, true, ControllerCoalesced}, // 111
+    {ControllerReleaseRate, 2, 3, true, ControllerCoalesced}, // 112
+    {ControllerKeyScaleLevel, 2, 5, false, ControllerCoalesced}, // 113
+    {ControllerLevel, 3, 1, false, ControllerImmediate}, // 114
+    {ControllerAttackRate, 3, 3, true, ControllerCoalesced}, // 115
+    {ControllerDecayRate, 3, 3, true, ControllerCoalesced}, // 116
+    {ControllerSustainLevel, 3, 3, true, ControllerCoalesced}, // 117
+    {ControllerReleaseRate, 3, 3, true, ControllerCoalesced}, // 118
+    {ControllerKeyScaleLevel, 3, 5, false, ControllerCoalesced}, // 119
+    {ControllerAllSoundOff, 0, 0, false, ControllerOrdered}, // 120
+    {ControllerResetAll, 0, 0, false, ControllerOrdered}, // 121
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 122
+    {ControllerAllNotesOff, 0, 0, false, ControllerOrdered}, // 123
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 124
+    {ControllerIgnored, 0, 0, false, ControllerImmediate}, // 125
+    {ControllerMonoMode, 0, 0, false, ControllerOrdered}, // 126
+    {ControllerPolyMode, 0, 0, false, ControllerOrdered} // 127
+};
+
+static inline void getControllerDescriptor(
+    uint8_t controller,
+    ControllerDescriptor &descriptor)
+{
+#ifdef ARDUINO
+    memcpy_P(&descriptor, &controllerTable[controller], sizeof(descriptor));
+#else
+    descriptor = controllerTable[controller];
+#endif
+}
+
+static_assert(MAX_PLAYING_NOTES <= 64, "NoteMask has one bit per note slot");
+
 MIDIControl::MIDIControl(OPL3::Hardware &opl3)
-: m_opl3(opl3),
+: m_numberOfChips(1),
   m_numberOfPlayingNotes(0),
-  m_previousMillis(millis())
+  m_melodicDrumCount(0),
+  m_fourOpNoteCount(0),
+  m_fourOpDemand(0),
+  m_fourOpDemandMillis(0),
+  m_voiceStealCount(0),
+  m_droppedNoteCount(0),
+  m_attenuationChanged(0),
+  m_numberOfPendingControllers(0),
+  m_previousMillis(millis()),
+  m_percussionIdleMillis(PERCUSSION_IDLE_MILLIS)
 {
+    m_chips[0] = &opl3;
+
+#if MAX_OPL3_CHIPS > 1
+    for (int i = 0; i < MAX_OPL3_CHIPS; ++ i) {
+        m_chipNoteCount[i] = 0;
+    }
+#endif
+
     // Default patch
     for (int i = 0; i < NUMBER_OF_MIDI_CHANNELS; ++ i) {
         m_channelData[i].type = OPL3::Melody2OpChannelType;
         m_channelData[i].outputs = 0x3;
         m_channelData[i].synthType = 0;
+        m_channelData[i].feedbackModulationFactor = 0;
 
         for (int op = 0; op < 4; ++ op) {
             m_channelData[i].operatorData[op].level = 48;
@@ -45,6 +279,7 @@ MIDIControl::MIDIControl(OPL3::Hardware &opl3)
             m_channelData[i].operatorData[op].tremolo = false;
             m_channelData[i].operatorData[op].vibrato = false;
             m_channelData[i].operatorData[op].envelopeScaling = false;
+            m_channelData[i].operatorData[op].sustain = true;
             m_channelData[i].operatorData[op].velocityToLevel = 32;
         }
 
@@ -52,453 +287,1186 @@ MIDIControl::MIDIControl(OPL3::Hardware &opl3)
         m_channelData[i].lfoStartDelay = 0;
         m_channelData[i].pitchBend = 0;
         m_channelData[i].sustaining = false;
+        m_channelData[i].sostenuto = false;
+        m_channelData[i].soft = false;
+        m_channelData[i].reservedVoices = 0;
+        m_channelData[i].maxVoices = 0;
+        m_channelData[i].mono = false;
+        m_channelData[i].portamento = false;
+        m_channelData[i].portamentoTime = 0;
+        m_channelData[i].unisonVoices = 0;
+        m_channelData[i].unisonDetune = 0;
+        m_channelData[i].unisonSpread = false;
     }
 
-    for (int i = 0; i < OPL3::NumberOfChannels; ++ i) {
+    for (int i = 0; i < MAX_PLAYING_NOTES; ++ i) {
         m_playingNotes[i].clear();
     }
+
+    for (int i = 0; i < NUMBER_OF_MIDI_CHANNELS; ++ i) {
+        m_channelNotes[i] = 0;
+    }
+
+    m_sustainedNotes = 0;
+    m_sostenutoNotes = 0;
+
+    for (int i = 0; i < MONO_VOICES; ++ i) {
+        m_monoVoices[i].noteCount = 0;
+    }
+
+#if MAX_ZONES > 0
+    for (int i = 0; i < MAX_ZONES; ++ i) {
+        m_zones[i].enabled = false;
+    }
+
+    updateZoneInputs();
+#endif
 }
 
 void MIDIControl::init()
 {
-    // TODO: Enable/disable this dynamically
-    //opl3.enablePercussion();
-
-    m_opl3.setVibratoDepth(true);
-    m_opl3.setTremoloDepth(false);
+    for (uint8_t chip = 0; chip < m_numberOfChips; ++ chip) {
+        m_chips[chip]->setVibratoDepth(true);
+        m_chips[chip]->setTremoloDepth(false);
+    }
 }
 
-void MIDIControl::playNote(
-    uint8_t channel,
-    uint8_t note,
-    uint8_t velocity)
+bool MIDIControl::addChip(
+    OPL3::Hardware &opl3)
 {
-    uint8_t opl3Channel = UnusedOpl3Channel;
-    NoteData *noteData = NULL;
-
-    if ((channel >= NUMBER_OF_MIDI_CHANNELS) || (note > 0x7f) || (velocity > 0x7f)) {
-        return;
+    if (m_numberOfChips == MAX_OPL3_CHIPS) {
+        return false;
     }
 
-    for (int i = 0; i < OPL3::NumberOfChannels; ++ i) {
-        if (m_playingNotes[i].opl3Channel == UnusedOpl3Channel) {
-            noteData = &m_playingNotes[i];
-            break;
-        }
+    m_chips[m_numberOfChips ++] = &opl3;
+
+    return true;
+}
+
+uint8_t MIDIControl::allocateChannel(
+    OPL3::ChannelType type,
+    uint8_t &chip)
+{
+    uint8_t keep4OpChannels = 0;
+
+    // 2-op notes are kept off the pairs of channels expected to be needed
+    // for 4-op notes
+    if ((type == OPL3::Melody2OpChannelType) && (m_fourOpDemand > m_fourOpNoteCount)) {
+        keep4OpChannels = m_fourOpDemand - m_fourOpNoteCount;
     }
 
-    if (!noteData)
-        return;
+#if MAX_OPL3_CHIPS > 1
+    uint8_t tried = 0;
 
-    opl3Channel = m_opl3.allocateChannel(m_channelData[channel].type);
+    // Try the chips with the fewest notes playing first, so the notes are
+    // spread evenly across them
+    for (uint8_t attempt = 0; attempt < m_numberOfChips; ++ attempt) {
+        chip = 0xff;
 
-    if (opl3Channel == OPL3::InvalidChannel) {
-        // Try to steal a channel for a note that is in the release phase
-        for (int i = 0; i < OPL3::NumberOfChannels; ++ i) {
-            if (m_playingNotes[i].releasing) {
-                noteData = &m_playingNotes[i];
-                opl3Channel = noteData->opl3Channel;
-                noteData->clear();
-                -- m_numberOfPlayingNotes;
-                break;
+        for (uint8_t i = 0; i < m_numberOfChips; ++ i) {
+            if ((!(tried & (1 << i)))
+             && ((chip == 0xff) || (m_chipNoteCount[i] < m_chipNoteCount[chip]))) {
+                chip = i;
             }
         }
-    }
 
-    if (opl3Channel == OPL3::InvalidChannel) {
-        return;
+        tried |= (1 << chip);
+
+        uint8_t opl3Channel = m_chips[chip]->allocateChannel(type, keep4OpChannels);
+        if (opl3Channel != OPL3::InvalidChannel) {
+            return opl3Channel;
+        }
     }
+#else
+    chip = 0;
 
-#if 0
-    Serial.print("Channel ");
-    Serial.print(opl3Channel);
-    Serial.println("");
+    uint8_t opl3Channel = m_chips[0]->allocateChannel(type, keep4OpChannels);
+    if (opl3Channel != OPL3::InvalidChannel) {
+        return opl3Channel;
+    }
 #endif
 
-    noteData->midiChannel = channel;
-    noteData->opl3Channel = opl3Channel;
-    noteData->midiNote = note;
-    noteData->velocity = velocity;
+    // Rhythm mode takes 3 melodic channels away, so it's only switched on
+    // when a percussion voice is wanted (service() switches it off again)
+    if (type >= OPL3::KickChannelType) {
+        for (chip = 0; chip < m_numberOfChips; ++ chip) {
+            if (!m_chips[chip]->isPercussionEnabled()) {
+                enablePercussion(chip);
+                return m_chips[chip]->allocateChannel(type);
+            }
+        }
+    }
 
-    ++ m_numberOfPlayingNotes;
+    return OPL3::InvalidChannel;
+}
 
-    // Set operator data
-    for (int op = 0; op < m_opl3.getOperatorCount(opl3Channel); ++ op) {
-        #define SET_OPERATOR_DATA(method, member) \
-            m_opl3.method(opl3Channel, op, m_channelData[channel].operatorData[op].member)
+void MIDIControl::enablePercussion(
+    uint8_t chip)
+{
+    uint8_t movedChannels[3];
 
-        SET_OPERATOR_DATA(setWaveform, waveform);
+    m_chips[chip]->enablePercussion(movedChannels);
+    m_percussionIdleMillis = 0;
 
-        // These get switched on when the LFO start delay elapses (if
-        // set for the operator)
-        m_opl3.setTremolo(opl3Channel, op, false);
-        m_opl3.setVibrato(opl3Channel, op, false);
+    for (int i = 0; i < MAX_PLAYING_NOTES; ++ i) {
+        NoteData &note = m_playingNotes[i];
 
-        // This doesn't seem useful to turn off and can probably be achieved
-        // with lowest sustain level anyway
-        m_opl3.setSustain(opl3Channel, op, true);
+        if ((note.opl3Channel < 6) || (note.opl3Channel > 8)
+         || (&getChip(note) != m_chips[chip])) {
+            continue;
+        }
 
-        SET_OPERATOR_DATA(setAttackRate, attackRate);
-        SET_OPERATOR_DATA(setDecayRate, decayRate);
-        SET_OPERATOR_DATA(setSustainLevel, sustainLevel);
-        SET_OPERATOR_DATA(setReleaseRate, releaseRate);
-        SET_OPERATOR_DATA(setKeyScaleLevel, keyScaleLevel);
-        SET_OPERATOR_DATA(setEnvelopeScaling, envelopeScaling);
-        SET_OPERATOR_DATA(setFrequencyMultiplicationFactor, frequencyMultiplicationFactor);
+        uint8_t newChannel = movedChannels[note.opl3Channel - 6];
 
-        #undef SET_OPERATOR_DATA
+        if (newChannel == OPL3::InvalidChannel) {
+            // The chip has already silenced and freed it
+            forgetNote(note);
+        } else {
+            note.opl3Channel = newChannel;
+        }
     }
-
-    // Separate per-operator loop to set the attenuation based on channel level,
-    // velocity-to-level and note velocity
-    updateAttenuation(channel);
-
-    // Set channel data
-    m_opl3.setOutput(opl3Channel, m_channelData[channel].outputs);
-    m_opl3.setSynthType(opl3Channel, m_channelData[channel].synthType);
-    m_opl3.setFeedbackModulationFactor(opl3Channel, m_channelData[channel].feedbackModulationFactor);
-    m_opl3.setFrequency(opl3Channel, getNoteFrequency(note, m_channelData[channel].pitchBend));
-    m_opl3.keyOn(opl3Channel);
 }
 
-void MIDIControl::stopNote(
+void MIDIControl::playNote(
     uint8_t channel,
-    uint8_t note)
+    uint8_t note,
+    uint8_t velocity)
 {
-    uint8_t opl3Channel = UnusedOpl3Channel;
-    NoteData *noteData = NULL;
+    PROFILE_SCOPE(ProfilePlayNote);
 
-    if ((channel >= NUMBER_OF_MIDI_CHANNELS) || (note > 0x7f)) {
+    if ((channel >= NUMBER_OF_MIDI_CHANNELS) || (note > 0x7f) || (velocity > 0x7f)) {
         return;
     }
 
-    // There could be several of the same note playing
-    for (int i = 0; i < OPL3::NumberOfChannels; ++ i) {
-        if ((m_playingNotes[i].midiNote == note)
-            && (m_playingNotes[i].midiChannel == channel)
-            && (m_playingNotes[i].opl3Channel != UnusedOpl3Channel)) {
-            noteData = &m_playingNotes[i];
-
-            opl3Channel = noteData->opl3Channel;
-            if (opl3Channel == UnusedOpl3Channel) {
-                return;
-            }
+#if MAX_ZONES > 0
+    if (m_zoneInputs & (1 << channel)) {
+        for (uint8_t i = 0; i < MAX_ZONES; ++ i) {
+            const Zone &zone = m_zones[i];
+            int16_t zoneNote = note + zone.transpose;
 
-            if (!m_channelData[channel].sustaining) {
-                // The OPL3 channel will be freed by service() to allow time
-                // for the release phase of envelopes
-                m_opl3.keyOff(opl3Channel);
-                noteData->releasing = true;
-            } else {
-                // Note will stop when the sustain pedal is released
-                noteData->sustained = true;
+            if ((isZoneNote(zone, channel, note))
+             && (velocity >= zone.lowVelocity) && (velocity <= zone.highVelocity)
+             && (zoneNote >= 0) && (zoneNote <= 0x7f)) {
+                startNote(zone.targetChannel, zoneNote, velocity);
             }
         }
+
+        return;
     }
+#endif
+
+    startNote(channel, note, velocity);
 }
 
-void MIDIControl::setController(
+void MIDIControl::startNote(
     uint8_t channel,
-    uint8_t controller,
-    uint8_t value)
+    uint8_t note,
+    uint8_t velocity)
 {
-    if ((channel >= NUMBER_OF_MIDI_CHANNELS) || (controller > 0x7f) || (value > 0x7f)) {
-        return;
-    }
+    OPL3::ChannelType type;
+    uint8_t frequencyNote = note;
 
-    #define CHANNEL_CONTROLLER_CASE(controller, method, member, value) \
-        case controller: \
-            m_channelData[channel].member = value; \
-            for (int i = 0; i < OPL3::NumberOfChannels; ++ i) { \
-                if (m_playingNotes[i].midiChannel == channel) \
-                    m_opl3.method(m_playingNotes[i].opl3Channel, value); \
-            } \
-            break;
+    // The note should be played with the latest controller values
+    applyPendingControllers(channel);
 
-    #define OPERATOR_CONTROLLER_CASE(controller, operatorIndex, method, member, value) \
-        case controller: \
-            m_channelData[channel].operatorData[operatorIndex].member = value; \
-            for (int i = 0; i < OPL3::NumberOfChannels; ++ i) { \
-                if ((m_playingNotes[i].midiChannel == channel) && (operatorIndex < m_opl3.getOperatorCount(m_playingNotes[i].opl3Channel))) \
-                    m_opl3.method(m_playingNotes[i].opl3Channel, operatorIndex, value); \
-            } \
-            break;
+    // In mono mode, a note played while another is held only changes pitch
+    if ((m_channelData[channel].mono) && (channel != PERCUSSION_MIDI_CHANNEL)
+        && (playLegato(channel, note))) {
+        return;
+    }
 
-    #define OPERATOR_CONTROLLER_CASES(op1Controller, op2Controller, op3Controller, op4Controller, method, member, value) \
-        OPERATOR_CONTROLLER_CASE(op1Controller, 0, method, member, value) \
-        OPERATOR_CONTROLLER_CASE(op2Controller, 1, method, member, value) \
-        OPERATOR_CONTROLLER_CASE(op3Controller, 2, method, member, value) \
-        OPERATOR_CONTROLLER_CASE(op4Controller, 3, method, member, value)
+    type = m_channelData[channel].type;
 
-    switch (controller) {
-        // Global
+    if (channel == PERCUSSION_MIDI_CHANNEL) {
+        BankPatch patch;
+        BankDrum drum;
 
-        case 22:
-        {
-            m_opl3.setTremoloDepth(value > 63);
-            break;
+        // Each percussion note has its own patch, played at a fixed note
+        if (!getPercussionPatch(note, patch, drum)) {
+            return;
         }
 
-        case 27:
-        {
-            m_opl3.setVibratoDepth(value > 63);
-            break;
+        if (drum.chokeGroup) {
+            chokeDrums(drum.chokeGroup);
         }
 
-        // General
+        m_percussionIdleMillis = 0;
 
-        case 7:
-        {
-            m_channelData[channel].volume = value >> 1;
-            updateAttenuation(channel);
-            break;
-        }
+        // The drum's patch is read from the bank whenever the note needs it,
+        // leaving the channel's own patch alone
+        frequencyNote = drum.playNote;
 
-        // This is a combination of channel type and synth type
-        // 0 - 11       2-op melody, synth type 0
-        // 12 - 23      2-op melody, synth type 1
-        // 24 - 35      4-op melody, synth type 0
-        // 36 - 47      4-op melody, synth type 1
-        // 48 - 59      4-op melody, synth type 2
-        // 60 - 71      4-op melody, synth type 3
-        // 72 - 82      percussion, kick
-        // 83 - 93      percussion, snare
-        // 94 - 104     percussion, tom-tom
-        // 105 - 115    percussion, cymbal
-        // 116 - 127    percussion, hi-hat
-        case 9:
-        {
-            OPL3::ChannelType newChannelType = m_channelData[channel].type;
-            
-            if (value < 24) {
-                newChannelType = OPL3::Melody2OpChannelType;
-                m_channelData[channel].synthType = value < 12 ? 0 : 1;
-            } else if (value < 72) {
-                newChannelType = OPL3::Melody4OpChannelType;
-                if (value < 36) {
-                    m_channelData[channel].synthType = 0;
-                } else if (value < 48) {
-                    m_channelData[channel].synthType = 1;
-                } else if (value < 60) {
-                    m_channelData[channel].synthType = 2;
-                } else {
-                    m_channelData[channel].synthType = 3;
-                }
-            } else if (value < 83) {
-                newChannelType = OPL3::KickChannelType;
-            } else if (value < 94) {
-                newChannelType = OPL3::SnareChannelType;
-            } else if (value < 105) {
-                newChannelType = OPL3::TomTomChannelType;
-            } else if (value < 116) {
-                newChannelType = OPL3::CymbalChannelType;
-            } else {
-                newChannelType = OPL3::HiHatChannelType;
-            }
+        if (drum.voice == OPL3::Melody2OpChannelType) {
+            type = (OPL3::ChannelType)patch.type;
 
-            if (m_channelData[channel].type != newChannelType) {
-                stopAllNotes(channel, true);
-                m_channelData[channel].type = newChannelType;
-                // TODO: If switching to 4-op, re-send control values for ops
-                // 3 and 4 because any changes in 2-op mode for those would've
-                // been ignored
+            if (type == OPL3::Melody4OpChannelType) {
+                expectFourOpNote();
             }
 
-            break;
+            if (m_melodicDrumCount >= DRUM_VOICES) {
+                stealDrum(type);
+            }
+        } else {
+            type = (OPL3::ChannelType)drum.voice;
         }
+    }
 
-        // Panning
-        CHANNEL_CONTROLLER_CASE(10, setOutput, outputs, (value < 43 ? 0x2 : (value > 85 ? 0x1 : 0x3)));
+    uint8_t voiceCount = (channel == PERCUSSION_MIDI_CHANNEL)
+                         ? 1 : m_channelData[channel].unisonVoices + 1;
 
-        case 12:    // LFO start delay
-            m_channelData[channel].lfoStartDelay = value >> 3;
-            break;
+    // The channel's oldest notes make way for this one if it's at its
+    // polyphony limit
+    if (m_channelData[channel].maxVoices) {
+        if (voiceCount > m_channelData[channel].maxVoices) {
+            voiceCount = m_channelData[channel].maxVoices;
+        }
 
-        case 64:    // Sustain pedal
-        {
-            bool doSustain = value > 63;
-            m_channelData[channel].sustaining = doSustain;
-            if (!doSustain) {
-                FOR_EACH_PLAYING_NOTE(channel, note,
-                    if (note.sustained) {
-                        note.sustained = false;                        
-                        note.releasing = true;
-                        m_opl3.keyOff(note.opl3Channel);
-                    }
-                );
-            }
-            break;
+        while ((getNoteCount(channel) + voiceCount > m_channelData[channel].maxVoices)
+            && (m_channelNotes[channel])) {
+            silenceOldestNote(channel);
         }
+    }
 
-        case 120:   // All sound off
-            stopAllNotes(channel, true);
-            break;
+    // Only the first voice of a unison note can take another note's channel,
+    // the others are left out if there aren't enough free
+    NoteData *notes[MAX_UNISON_VOICES];
+    uint8_t noteCount = 0;
 
-        case 121:   // Reset controllers to default values
-            // TODO
-            break;
+    for (; noteCount < voiceCount; ++ noteCount) {
+        NoteData *noteData = allocateNote(channel, type, noteCount == 0);
 
-        case 123:   // All notes off
-            stopAllNotes(channel, false);
+        if (!noteData) {
             break;
+        }
 
-        // Basic operator controls
-
-        OPERATOR_CONTROLLER_CASES(18, 19, 20, 21, setWaveform, waveform, value >> 4)
-        OPERATOR_CONTROLLER_CASES(86, 103, 109, 115, setAttackRate, attackRate, 15 - (value >> 3))
-        OPERATOR_CONTROLLER_CASES(87, 104, 110, 116, setDecayRate, decayRate, 15 - (value >> 3))
-        OPERATOR_CONTROLLER_CASES(88, 105, 111, 117, setSustainLevel, sustainLevel, 15 - (value >> 3))
-        OPERATOR_CONTROLLER_CASES(89, 106, 112, 118, setReleaseRate, releaseRate, 15 - (value >> 3))
-        OPERATOR_CONTROLLER_CASES(90, 107, 113, 119, setKeyScaleLevel, keyScaleLevel, value >> 5)       // FIXME: need to swap 1 and 2 around
-        OPERATOR_CONTROLLER_CASES(80, 81, 82, 83, setEnvelopeScaling, envelopeScaling, value >> 6)
-        OPERATOR_CONTROLLER_CASES(75, 76, 77, 78, setFrequencyMultiplicationFactor, frequencyMultiplicationFactor, value >> 3)
-
-        // Operator 1
-
-        case 23:
-            // TODO: When tremolo/vibrato being turned on for any operator it should
-            // clear lfoTriggered for the note, and when turning either of these
-            // off it should immediately stop them
-            //m_channelData[channel].operatorData[0].tremolo = value >> 6;
-            setTremolo(channel, 0, value >> 6);
-            break;
+        noteData->midiChannel = channel;
+        noteData->midiNote = note;
+        noteData->velocity = velocity;
+        noteData->unisonVoice = noteCount;
 
-        case 28:
-            //m_channelData[channel].operatorData[0].vibrato = value >> 6;
-            setVibrato(channel, 0, value >> 6);
-            break;
+        m_channelNotes[channel] |= ((NoteMask)1 << (noteData - m_playingNotes));
+        ++ m_numberOfPlayingNotes;
+#if MAX_OPL3_CHIPS > 1
+        ++ m_chipNoteCount[noteData->chip];
+#endif
 
-        case 85:
-        {
-            m_channelData[channel].operatorData[0].level = value >> 1;
-            updateAttenuation(channel);
-            break;
+        if (isMelodicDrum(*noteData)) {
+            ++ m_melodicDrumCount;
         }
 
-        case 14:
-        {
-            m_channelData[channel].operatorData[0].velocityToLevel = value >> 1;
-            updateAttenuation(channel);
-            break;
+        if (getChip(*noteData).getChannelType(noteData->opl3Channel) == OPL3::Melody4OpChannelType) {
+            if (++ m_fourOpNoteCount > m_fourOpDemand) {
+                m_fourOpDemand = m_fourOpNoteCount;
+            }
         }
 
-        // This is a channel setting that affects operator 1 only
-        CHANNEL_CONTROLLER_CASE(79, setFeedbackModulationFactor, feedbackModulationFactor, value >> 4);
-
-        // Operator 2
+        notes[noteCount] = noteData;
+    }
 
-        case 24:
-            //m_channelData[channel].operatorData[1].tremolo = value >> 6;
-            setTremolo(channel, 1, value >> 6);
-            break;
+    if (!noteCount) {
+        ++ m_droppedNoteCount;
+        return;
+    }
 
-        case 29:
-            //m_channelData[channel].operatorData[1].vibrato = value >> 6;
-            setVibrato(channel, 1, value >> 6);
-            break;
+    uploadPatch(notes, noteCount);
 
-        case 102:
-        {
-            m_channelData[channel].operatorData[1].level = value >> 1;
-            updateAttenuation(channel);
-            break;
-        }
+    for (uint8_t i = 0; i < noteCount; ++ i) {
+        OPL3::Hardware &opl3 = getChip(*notes[i]);
+        int16_t cents = m_channelData[channel].pitchBend + getUnisonDetune(*notes[i]);
 
-        case 15:
-        {
-            m_channelData[channel].operatorData[1].velocityToLevel = value >> 1;
-            updateAttenuation(channel);
-            break;
-        }
+        opl3.setFrequency(notes[i]->opl3Channel, getNoteFrequency(frequencyNote, cents));
+        opl3.keyOn(notes[i]->opl3Channel);
+    }
+}
 
-        // Operator 3
+MIDIControl::NoteData *MIDIControl::allocateNote(
+    uint8_t channel,
+    OPL3::ChannelType type,
+    bool steal)
+{
+    uint8_t opl3Channel = OPL3::InvalidChannel;
+    uint8_t chip = 0;
+    NoteData *noteData = NULL;
 
-        case 25:
-            //m_channelData[channel].operatorData[2].tremolo = value >> 6;
-            setTremolo(channel, 2, value >> 6);
+    for (int i = 0; i < MAX_PLAYING_NOTES; ++ i) {
+        if (m_playingNotes[i].opl3Channel == UnusedOpl3Channel) {
+            noteData = &m_playingNotes[i];
             break;
+        }
+    }
 
-        case 30:
-            //m_channelData[channel].operatorData[2].vibrato = value >> 6;
-            setVibrato(channel, 2, value >> 6);
-            break;
+    if (!noteData) {
+        return NULL;
+    }
 
-        case 108:
-        {
-            m_channelData[channel].operatorData[2].level = value >> 1;
-            updateAttenuation(channel);
-            break;
-        }
+    if (!isReservedForOthers(channel, type)) {
+        opl3Channel = allocateChannel(type, chip);
+    }
 
-        case 16:
-        {
-            m_channelData[channel].operatorData[2].velocityToLevel = value >> 1;
-            updateAttenuation(channel);
-            break;
-        }
+    // Drums only ever take over each other's channels
+    if ((opl3Channel == OPL3::InvalidChannel) && (steal) && (channel == PERCUSSION_MIDI_CHANNEL)
+     && (stealDrum(type))) {
+        opl3Channel = allocateChannel(type, chip);
+    }
 
-        // Operator 4
+    if ((opl3Channel == OPL3::InvalidChannel) && (steal) && (type == OPL3::Melody4OpChannelType)) {
+        // Keep more pairs of channels free for 4-op notes from now on
+        expectFourOpNote();
+    }
 
-        case 26:
-            //m_channelData[channel].operatorData[3].tremolo = value >> 6;
-            setTremolo(channel, 3, value >> 6);
-            break;
+    if ((opl3Channel == OPL3::InvalidChannel) && (steal) && (channel != PERCUSSION_MIDI_CHANNEL)) {
+        NoteData *stolenNote = findNoteToSteal(channel, type);
 
-        case 31:
-            //m_channelData[channel].operatorData[3].vibrato = value >> 6;
-            setVibrato(channel, 3, value >> 6);
-            break;
+        if (stolenNote) {
+            noteData = stolenNote;
+            opl3Channel = noteData->opl3Channel;
+#if MAX_OPL3_CHIPS > 1
+            chip = noteData->chip;
+#endif
+            // The new note needs a key on to start its envelopes
+            if (!noteData->releasing) {
+                getChip(*noteData).keyOff(opl3Channel);
+            }
 
-        case 114:
-        {
-            m_channelData[channel].operatorData[3].level = value >> 1;
-            updateAttenuation(channel);
-            break;
+            forgetNote(*noteData);
+            ++ m_voiceStealCount;
         }
+    }
 
-        case 17:
-        {
-            m_channelData[channel].operatorData[3].velocityToLevel = value >> 1;
-            updateAttenuation(channel);
-            break;
-        }
+    if (opl3Channel == OPL3::InvalidChannel) {
+        return NULL;
+    }
 
-        default:
-            break;
-    };
+    noteData->opl3Channel = opl3Channel;
+#if MAX_OPL3_CHIPS > 1
+    noteData->chip = chip;
+#endif
 
-    #undef CHANNEL_CONTROLLER_CASE
-    #undef OPERATOR_CONTROLLER_CASE
+    return noteData;
 }
 
-void MIDIControl::setPitchBend(
-    uint8_t channel,
-    uint16_t amount)
+void MIDIControl::chokeDrums(
+    uint8_t chokeGroup)
 {
-    if ((channel >= NUMBER_OF_MIDI_CHANNELS) || (amount > 0x7fff))
-        return;
-
-    // This gives a range from -200 to +200
-    int16_t cents = (((int32_t)amount - 8192) * 100) / (amount < 8192 ? 4096 : 4095);
-    m_channelData[channel].pitchBend = cents;
+    FOR_EACH_PLAYING_NOTE(PERCUSSION_MIDI_CHANNEL, note,
+        BankDrum drum;
 
-    FOR_EACH_PLAYING_NOTE(channel, note,
-        m_opl3.setFrequency(note.opl3Channel, getNoteFrequency(note.midiNote, m_channelData[note.midiChannel].pitchBend));
+        if ((getPercussionDrum(note.midiNote, drum)) && (drum.chokeGroup == chokeGroup)) {
+            silence(note);
+        }
     );
 }
 
-void MIDIControl::service()
+bool MIDIControl::stealDrum(
+    OPL3::ChannelType type)
 {
-    unsigned long elapsedMillis = millis() - m_previousMillis;
+    NoteData *oldest = NULL;
 
-    if (elapsedMillis == 0)
-        return;
+    FOR_EACH_PLAYING_NOTE(PERCUSSION_MIDI_CHANNEL, note,
+        if ((getChip(note).getChannelType(note.opl3Channel) == type)
+         && ((!oldest) || (note.duration > oldest->duration))) {
+            oldest = &note;
+        }
+    );
 
-    m_previousMillis = millis();
+    if (!oldest) {
+        return false;
+    }
+
+    silence(*oldest);
+    ++ m_voiceStealCount;
+
+    return true;
+}
+
+bool MIDIControl::isReservedForOthers(
+    uint8_t channel,
+    OPL3::ChannelType type) const
+{
+    uint8_t freeVoices = 0;
+    uint8_t neededVoices = (type == OPL3::Melody4OpChannelType) ? 2 : 1;
+    uint8_t reservedVoices = 0;
+
+    // A channel can always use its own reserved voices, and the rhythm
+    // voices aren't shared
+    if ((type >= OPL3::KickChannelType)
+     || (getNoteCount(channel) < m_channelData[channel].reservedVoices)) {
+        return false;
+    }
+
+    for (uint8_t other = 0; other < NUMBER_OF_MIDI_CHANNELS; ++ other) {
+        if ((other != channel) && (m_channelData[other].reservedVoices)) {
+            uint8_t noteCount = getNoteCount(other);
+
+            if (noteCount < m_channelData[other].reservedVoices) {
+                reservedVoices += m_channelData[other].reservedVoices - noteCount;
+            }
+        }
+    }
+
+    if ((channel != PERCUSSION_MIDI_CHANNEL) && (m_melodicDrumCount < DRUM_VOICES)
+     && (m_percussionIdleMillis < PERCUSSION_IDLE_MILLIS)) {
+        reservedVoices += DRUM_VOICES - m_melodicDrumCount;
+    }
+
+    if (!reservedVoices) {
+        return false;
+    }
+
+    // A free 4-op channel can be split into two 2-op channels
+    for (uint8_t chip = 0; chip < m_numberOfChips; ++ chip) {
+        freeVoices += m_chips[chip]->getFreeChannelCount(OPL3::Melody2OpChannelType);
+        freeVoices += m_chips[chip]->getFreeChannelCount(OPL3::Melody4OpChannelType) * 2;
+    }
+
+    return freeVoices < neededVoices + reservedVoices;
+}
+
+bool MIDIControl::isOverReservation(
+    uint8_t channel) const
+{
+    return (!m_channelData[channel].reservedVoices)
+        || (getNoteCount(channel) > m_channelData[channel].reservedVoices);
+}
+
+uint8_t MIDIControl::getNoteCount(
+    uint8_t channel) const
+{
+    uint8_t count = 0;
+
+    for (NoteMask mask = m_channelNotes[channel]; mask; mask >>= 1) {
+        count += mask & 1;
+    }
+
+    return count;
+}
+
+MIDIControl::NoteData *MIDIControl::findNoteToSteal(
+    uint8_t channel,
+    OPL3::ChannelType type)
+{
+    NoteData *oldest = NULL;
+    bool withinReservation = (getNoteCount(channel) < m_channelData[channel].reservedVoices);
+
+    for (int i = 0; i < MAX_PLAYING_NOTES; ++ i) {
+        NoteData &note = m_playingNotes[i];
+
+        if ((note.opl3Channel == UnusedOpl3Channel)
+         || (note.midiChannel == PERCUSSION_MIDI_CHANNEL)
+         || (getChip(note).getChannelType(note.opl3Channel) != type)
+         || (!isOverReservation(note.midiChannel))) {
+            continue;
+        }
+
+        // Any releasing note will do
+        if (note.releasing) {
+            return &note;
+        }
+
+        // A channel short of its reserved voices can also cut off the
+        // longest playing note of a channel that's over its reservation
+        if ((withinReservation) && ((!oldest) || (note.duration > oldest->duration))) {
+            oldest = &note;
+        }
+    }
+
+    return oldest;
+}
+
+void MIDIControl::silenceOldestNote(
+    uint8_t channel)
+{
+    NoteData *oldest = NULL;
+
+    // Releasing notes go first
+    FOR_EACH_PLAYING_NOTE(channel, note,
+        if ((!oldest)
+         || ((note.releasing) && (!oldest->releasing))
+         || ((note.releasing == oldest->releasing) && (note.duration > oldest->duration))) {
+            oldest = &note;
+        }
+    );
+
+    if (oldest) {
+        silence(*oldest);
+        ++ m_voiceStealCount;
+    }
+}
+
+void MIDIControl::stopNote(
+    uint8_t channel,
+    uint8_t note)
+{
+    PROFILE_SCOPE(ProfileStopNote);
+
+    if ((channel >= NUMBER_OF_MIDI_CHANNELS) || (note > 0x7f)) {
+        return;
+    }
+
+#if MAX_ZONES > 0
+    // The velocity of the note on isn't known, so this goes to every zone
+    // the note is in (stopping a note that isn't playing does nothing)
+    if (m_zoneInputs & (1 << channel)) {
+        for (uint8_t i = 0; i < MAX_ZONES; ++ i) {
+            const Zone &zone = m_zones[i];
+            int16_t zoneNote = note + zone.transpose;
+
+            if ((isZoneNote(zone, channel, note)) && (zoneNote >= 0) && (zoneNote <= 0x7f)) {
+                releaseNote(zone.targetChannel, zoneNote);
+            }
+        }
+
+        return;
+    }
+#endif
+
+    releaseNote(channel, note);
+}
+
+void MIDIControl::releaseNote(
+    uint8_t channel,
+    uint8_t note)
+{
+    uint8_t opl3Channel = UnusedOpl3Channel;
+    NoteData *noteData = NULL;
+
+    if ((m_channelData[channel].mono) && (stopLegato(channel, note))) {
+        return;
+    }
+
+    // There could be several of the same note playing
+    FOR_EACH_PLAYING_NOTE(channel, playingNote,
+        if (playingNote.midiNote == note) {
+            noteData = &playingNote;
+
+            opl3Channel = noteData->opl3Channel;
+            if (opl3Channel == UnusedOpl3Channel) {
+                return;
+            }
+
+            if ((!m_channelData[channel].sustaining)
+             && (!(m_sostenutoNotes & getNoteMask(*noteData)))) {
+                // The OPL3 channel will be freed by service() to allow time
+                // for the release phase of envelopes
+                getChip(*noteData).keyOff(opl3Channel);
+                noteData->releasing = true;
+            } else {
+                // Note will stop when the pedals are released
+                m_sustainedNotes |= getNoteMask(*noteData);
+            }
+        }
+    );
+}
+
+void MIDIControl::setController(
+    uint8_t channel,
+    uint8_t controller,
+    uint8_t value)
+{
+    if ((channel >= NUMBER_OF_MIDI_CHANNELS) || (controller > 0x7f) || (value > 0x7f)) {
+        return;
+    }
+
+    uint16_t channels = getZoneTargets(channel) | (1 << channel);
+
+    for (uint8_t target = 0; channels; ++ target, channels >>= 1) {
+        if (channels & 1) {
+            queueController(target, controller, value);
+        }
+    }
+}
+
+void MIDIControl::queueController(
+    uint8_t channel,
+    uint8_t controller,
+    uint8_t value)
+{
+    ControllerDescriptor descriptor;
+
+    getControllerDescriptor(controller, descriptor);
+
+    switch (descriptor.timing) {
+        case ControllerCoalesced:
+            // Knobs on the front panel send a burst of these as they turn,
+            // and only the last one matters
+            for (uint8_t i = 0; i < m_numberOfPendingControllers; ++ i) {
+                PendingController &pending = m_pendingControllers[i];
+                if ((pending.channel == channel) && (pending.controller == controller)) {
+                    pending.value = value;
+                    return;
+                }
+            }
+
+            if (m_numberOfPendingControllers < PENDING_CONTROLLERS) {
+                PendingController &pending = m_pendingControllers[m_numberOfPendingControllers ++];
+                pending.channel = channel;
+                pending.controller = controller;
+                pending.value = value;
+                return;
+            }
+
+            // No room, so apply it now
+            break;
+
+        case ControllerOrdered:
+            applyPendingControllers(channel);
+            break;
+
+        default:
+            break;
+    };
+
+    applyController(channel, controller, value);
+}
+
+void MIDIControl::applyPendingControllers(
+    uint8_t channel)
+{
+    uint8_t remaining = 0;
+
+    for (uint8_t i = 0; i < m_numberOfPendingControllers; ++ i) {
+        PendingController &pending = m_pendingControllers[i];
+
+        if ((channel == AllMidiChannels) || (pending.channel == channel)) {
+            applyController(pending.channel, pending.controller, pending.value);
+        } else {
+            m_pendingControllers[remaining ++] = pending;
+        }
+    }
+
+    m_numberOfPendingControllers = remaining;
+}
+
+void MIDIControl::applyController(
+    uint8_t channel,
+    uint8_t controller,
+    uint8_t value)
+{
+    PROFILE_SCOPE(ProfileSetController);
+
+    ControllerDescriptor descriptor;
+
+    getControllerDescriptor(controller, descriptor);
+
+    uint8_t operatorIndex = descriptor.operatorIndex;
+
+    value >>= descriptor.shift;
+
+    if (descriptor.inverted) {
+        value = 15 - value;
+    }
+
+    #define CHANNEL_CONTROLLER_CASE(target, method, member) \
+        case target: \
+            m_channelData[channel].member = value; \
+            FOR_EACH_PLAYING_NOTE(channel, note, \
+                getChip(note).method(note.opl3Channel, value); \
+            ); \
+            break;
+
+    #define OPERATOR_CONTROLLER_CASE(target, method, member) \
+        case target: \
+            m_channelData[channel].operatorData[operatorIndex].member = value; \
+            FOR_EACH_PLAYING_NOTE(channel, note, \
+                if (operatorIndex < getChip(note).getOperatorCount(note.opl3Channel)) \
+                    getChip(note).method(note.opl3Channel, operatorIndex, value); \
+            ); \
+            break;
+
+    switch (descriptor.target) {
+        case ControllerIgnored:
+            break;
+
+        // Global
+
+        case ControllerTremoloDepth:
+            for (uint8_t chip = 0; chip < m_numberOfChips; ++ chip) {
+                m_chips[chip]->setTremoloDepth(value);
+            }
+            break;
+
+        case ControllerVibratoDepth:
+            for (uint8_t chip = 0; chip < m_numberOfChips; ++ chip) {
+                m_chips[chip]->setVibratoDepth(value);
+            }
+            break;
+
+        // General
+
+        case ControllerVolume:
+            m_channelData[channel].volume = value;
+            m_attenuationChanged |= (1 << channel);
+            break;
+
+        // This is a combination of channel type and synth type
+        // 0 - 11       2-op melody, synth type 0
+        // 12 - 23      2-op melody, synth type 1
+        // 24 - 35      4-op melody, synth type 0
+        // 36 - 47      4-op melody, synth type 1
+        // 48 - 59      4-op melody, synth type 2
+        // 60 - 71      4-op melody, synth type 3
+        // 72 - 82      percussion, kick
+        // 83 - 93      percussion, snare
+        // 94 - 104     percussion, tom-tom
+        // 105 - 115    percussion, cymbal
+        // 116 - 127    percussion, hi-hat
+        case ControllerChannelType:
+        {
+            OPL3::ChannelType newChannelType = m_channelData[channel].type;
+            
+            if (value < 24) {
+                newChannelType = OPL3::Melody2OpChannelType;
+                m_channelData[channel].synthType = value < 12 ? 0 : 1;
+            } else if (value < 72) {
+                newChannelType = OPL3::Melody4OpChannelType;
+                if (value < 36) {
+                    m_channelData[channel].synthType = 0;
+                } else if (value < 48) {
+                    m_channelData[channel].synthType = 1;
+                } else if (value < 60) {
+                    m_channelData[channel].synthType = 2;
+                } else {
+                    m_channelData[channel].synthType = 3;
+                }
+            } else if (value < 83) {
+                newChannelType = OPL3::KickChannelType;
+            } else if (value < 94) {
+                newChannelType = OPL3::SnareChannelType;
+            } else if (value < 105) {
+                newChannelType = OPL3::TomTomChannelType;
+            } else if (value < 116) {
+                newChannelType = OPL3::CymbalChannelType;
+            } else {
+                newChannelType = OPL3::HiHatChannelType;
+            }
+
+            // TODO: If switching to 4-op, re-send control values for ops
+            // 3 and 4 because any changes in 2-op mode for those would've
+            // been ignored
+            setChannelType(channel, newChannelType);
+
+            break;
+        }
+
+        case ControllerPanning:
+            value = (value < 43 ? 0x2 : (value > 85 ? 0x1 : 0x3));
+            m_channelData[channel].outputs = value;
+            FOR_EACH_PLAYING_NOTE(channel, note,
+                getChip(note).setOutput(note.opl3Channel, getNoteOutputs(note));
+            );
+            break;
+
+        case ControllerUnisonVoices:
+            m_channelData[channel].unisonVoices = value;
+            break;
+
+        case ControllerUnisonDetune:
+            m_channelData[channel].unisonDetune = value;
+            if (channel != PERCUSSION_MIDI_CHANNEL) {
+                FOR_EACH_PLAYING_NOTE(channel, note,
+                    updateFrequency(note);
+                );
+            }
+            break;
+
+        case ControllerUnisonSpread:
+            m_channelData[channel].unisonSpread = value;
+            FOR_EACH_PLAYING_NOTE(channel, note,
+                getChip(note).setOutput(note.opl3Channel, getNoteOutputs(note));
+            );
+            break;
+
+        case ControllerLFOStartDelay:
+            m_channelData[channel].lfoStartDelay = value;
+            break;
+
+        // Only affect notes played from now on
+        case ControllerReservedVoices:
+            m_channelData[channel].reservedVoices = value;
+            break;
+
+        case ControllerMaxVoices:
+            m_channelData[channel].maxVoices = value;
+            break;
+
+        // This is a channel setting that affects operator 1 only
+        CHANNEL_CONTROLLER_CASE(ControllerFeedbackModulationFactor, setFeedbackModulationFactor, feedbackModulationFactor);
+
+        case ControllerSustainPedal:
+            m_channelData[channel].sustaining = value;
+            if (!value) {
+                // Notes still held by sostenuto carry on
+                keyOffNotes(m_sustainedNotes & m_channelNotes[channel] & ~m_sostenutoNotes);
+            }
+            break;
+
+        // Only the notes whose keys are held when the pedal is pressed are
+        // sustained
+        case ControllerSostenutoPedal:
+            if ((value) && (!m_channelData[channel].sostenuto)) {
+                FOR_EACH_PLAYING_NOTE(channel, note,
+                    if ((!note.releasing) && (!(m_sustainedNotes & getNoteMask(note)))) {
+                        m_sostenutoNotes |= getNoteMask(note);
+                    }
+                );
+            } else if ((!value) && (m_channelData[channel].sostenuto)) {
+                NoteMask notes = m_sostenutoNotes & m_channelNotes[channel];
+
+                m_sostenutoNotes &= ~notes;
+
+                if (!m_channelData[channel].sustaining) {
+                    keyOffNotes(notes & m_sustainedNotes);
+                }
+            }
+
+            m_channelData[channel].sostenuto = value;
+            break;
+
+        case ControllerSoftPedal:
+            m_channelData[channel].soft = value;
+            m_attenuationChanged |= (1 << channel);
+            break;
+
+        case ControllerPortamento:
+            m_channelData[channel].portamento = value;
+            break;
+
+        case ControllerPortamentoTime:
+            m_channelData[channel].portamentoTime = value;
+            break;
+
+        // As with all notes off, any playing notes are stopped
+        case ControllerMonoMode:
+        case ControllerPolyMode:
+            stopAllNotes(channel, true);
+            m_channelData[channel].mono = (descriptor.target == ControllerMonoMode);
+            break;
+
+        case ControllerAllSoundOff:
+            stopAllNotes(channel, true);
+            break;
+
+        case ControllerResetAll:
+            // TODO
+            break;
+
+        case ControllerAllNotesOff:
+            stopAllNotes(channel, false);
+            break;
+
+        // Operators
+
+        OPERATOR_CONTROLLER_CASE(ControllerWaveform, setWaveform, waveform)
+        OPERATOR_CONTROLLER_CASE(ControllerAttackRate, setAttackRate, attackRate)
+        OPERATOR_CONTROLLER_CASE(ControllerDecayRate, setDecayRate, decayRate)
+        OPERATOR_CONTROLLER_CASE(ControllerSustainLevel, setSustainLevel, sustainLevel)
+        OPERATOR_CONTROLLER_CASE(ControllerReleaseRate, setReleaseRate, releaseRate)
+        OPERATOR_CONTROLLER_CASE(ControllerKeyScaleLevel, setKeyScaleLevel, keyScaleLevel)     // FIXME: need to swap 1 and 2 around
+        OPERATOR_CONTROLLER_CASE(ControllerEnvelopeScaling, setEnvelopeScaling, envelopeScaling)
+        OPERATOR_CONTROLLER_CASE(ControllerFrequencyMultiplicationFactor, setFrequencyMultiplicationFactor, frequencyMultiplicationFactor)
+
+        // TODO: When tremolo/vibrato being turned on for any operator it should
+        // clear lfoTriggered for the note, and when turning either of these
+        // off it should immediately stop them
+        case ControllerTremolo:
+            setTremolo(channel, operatorIndex, value);
+            break;
+
+        case ControllerVibrato:
+            setVibrato(channel, operatorIndex, value);
+            break;
+
+        case ControllerLevel:
+            m_channelData[channel].operatorData[operatorIndex].level = value;
+            m_attenuationChanged |= (1 << channel);
+            break;
+
+        case ControllerVelocityToLevel:
+            m_channelData[channel].operatorData[operatorIndex].velocityToLevel = value;
+            m_attenuationChanged |= (1 << channel);
+            break;
+
+        default:
+            break;
+    };
+
+    #undef CHANNEL_CONTROLLER_CASE
+    #undef OPERATOR_CONTROLLER_CASE
+}
+
+void MIDIControl::setPitchBend(
+    uint8_t channel,
+    uint16_t amount)
+{
+    if ((channel >= NUMBER_OF_MIDI_CHANNELS) || (amount > 0x7fff))
+        return;
+
+    uint16_t channels = getZoneTargets(channel) | (1 << channel);
+
+    for (uint8_t target = 0; channels; ++ target, channels >>= 1) {
+        if (channels & 1) {
+            bendChannel(target, amount);
+        }
+    }
+}
+
+void MIDIControl::bendChannel(
+    uint8_t channel,
+    uint16_t amount)
+{
+    // This gives a range from -200 to +200
+    int16_t cents = (((int32_t)amount - 8192) * 100) / (amount < 8192 ? 4096 : 4095);
+    m_channelData[channel].pitchBend = cents;
+
+    // Percussion notes are played at a fixed note (see playNote)
+    if (channel == PERCUSSION_MIDI_CHANNEL) {
+        return;
+    }
+
+    // The note jumps to the end of any glide
+    MonoVoice *voice = findMonoVoice(channel, false);
+    if (voice) {
+        voice->glideStep = 0;
+    }
+
+    FOR_EACH_PLAYING_NOTE(channel, note,
+        updateFrequency(note);
+    );
+}
+
+void MIDIControl::setProgram(
+    uint8_t channel,
+    uint8_t program)
+{
+    BankPatch patch;
+
+    // The percussion channel uses a patch for each note instead
+    if ((channel >= NUMBER_OF_MIDI_CHANNELS) || (channel == PERCUSSION_MIDI_CHANNEL)) {
+        return;
+    }
+
+    if (!getProgramPatch(program, patch)) {
+        return;
+    }
+
+    // These were sent for the previous patch
+    applyPendingControllers(channel);
+
+    loadPatch(channel, patch);
+}
+
+bool MIDIControl::storePatch(
+    uint8_t channel,
+    uint8_t slot)
+{
+    UserPatch patch;
+
+    // The percussion channel's patch is just whichever drum played last
+    if ((channel >= NUMBER_OF_MIDI_CHANNELS) || (channel == PERCUSSION_MIDI_CHANNEL)) {
+        return false;
+    }
+
+    // Knob movements the panel has just sent should be included
+    applyPendingControllers(channel);
+
+    MidiChannelData &channelData = m_channelData[channel];
+
+    patch.type = channelData.type;
+    patch.feedbackModulationFactor = channelData.feedbackModulationFactor;
+    patch.synthType = channelData.synthType;
+    memcpy(patch.operators, channelData.operatorData, sizeof(patch.operators));
+
+    return writeUserPatch(slot, patch);
+}
+
+bool MIDIControl::recallPatch(
+    uint8_t channel,
+    uint8_t slot)
+{
+    UserPatch patch;
+
+    if ((channel >= NUMBER_OF_MIDI_CHANNELS) || (channel == PERCUSSION_MIDI_CHANNEL)) {
+        return false;
+    }
+
+    if (!readUserPatch(slot, patch)) {
+        return false;
+    }
+
+    // These were sent for the previous patch
+    applyPendingControllers(channel);
+
+    applyUserPatch(channel, patch);
+
+    return true;
+}
+
+void MIDIControl::getChannelPatch(
+    uint8_t channel,
+    ChannelPatch &patch)
+{
+    if (channel >= NUMBER_OF_MIDI_CHANNELS) {
+        return;
+    }
+
+    applyPendingControllers(channel);
+
+    MidiChannelData &channelData = m_channelData[channel];
+
+    patch.patch.type = channelData.type;
+    patch.patch.feedbackModulationFactor = channelData.feedbackModulationFactor;
+    patch.patch.synthType = channelData.synthType;
+    memcpy(patch.patch.operators, channelData.operatorData, sizeof(patch.patch.operators));
+    patch.outputs = channelData.outputs;
+    patch.volume = channelData.volume;
+    patch.lfoStartDelay = channelData.lfoStartDelay;
+}
+
+bool MIDIControl::setChannelPatch(
+    uint8_t channel,
+    const ChannelPatch &patch)
+{
+    if ((channel >= NUMBER_OF_MIDI_CHANNELS) || (channel == PERCUSSION_MIDI_CHANNEL)) {
+        return false;
+    }
+
+    if ((patch.patch.type != OPL3::Melody2OpChannelType)
+     && (patch.patch.type != OPL3::Melody4OpChannelType)) {
+        return false;
+    }
+
+    applyPendingControllers(channel);
+
+    MidiChannelData &channelData = m_channelData[channel];
+
+    // Uploading the patch also sets the attenuation and outputs
+    channelData.outputs = patch.outputs;
+    channelData.volume = patch.volume;
+    channelData.lfoStartDelay = patch.lfoStartDelay;
+
+    applyUserPatch(channel, patch.patch);
+
+    return true;
+}
+
+unsigned int MIDIControl::getVoiceStealCount() const
+{
+    return m_voiceStealCount;
+}
+
+unsigned int MIDIControl::getDroppedNoteCount() const
+{
+    return m_droppedNoteCount;
+}
+
+bool MIDIControl::setZone(
+    uint8_t index,
+    const Zone &zone)
+{
+#if MAX_ZONES > 0
+    if (index >= MAX_ZONES) {
+        return false;
+    }
+
+    // Notes started through the old zone would no longer be stopped
+    if (m_zones[index].enabled) {
+        stopAllNotes(m_zones[index].targetChannel);
+    }
+
+    m_zones[index] = zone;
+
+    if (zone.enabled) {
+        setProgram(zone.targetChannel, zone.program);
+    }
+
+    updateZoneInputs();
+
+    return true;
+#else
+    (void)index;
+    (void)zone;
+
+    return false;
+#endif
+}
+
+uint16_t MIDIControl::getZoneTargets(
+    uint8_t channel) const
+{
+    uint16_t targets = 0;
+
+#if MAX_ZONES > 0
+    if (m_zoneInputs & (1 << channel)) {
+        for (uint8_t i = 0; i < MAX_ZONES; ++ i) {
+            if ((m_zones[i].enabled) && (m_zones[i].inputChannel == channel)) {
+                targets |= 1 << m_zones[i].targetChannel;
+            }
+        }
+    }
+#else
+    (void)channel;
+#endif
+
+    return targets;
+}
+
+#if MAX_ZONES > 0
+bool MIDIControl::isZoneNote(
+    const Zone &zone,
+    uint8_t channel,
+    uint8_t note) const
+{
+    return (zone.enabled) && (zone.inputChannel == channel)
+        && (note >= zone.lowNote) && (note <= zone.highNote);
+}
+
+void MIDIControl::updateZoneInputs()
+{
+    m_zoneInputs = 0;
+
+    for (uint8_t i = 0; i < MAX_ZONES; ++ i) {
+        if (m_zones[i].enabled) {
+            m_zoneInputs |= 1 << m_zones[i].inputChannel;
+        }
+    }
+}
+#endif
 
-    for (int noteSlot = 0; noteSlot < OPL3::NumberOfChannels; ++ noteSlot) {
+void MIDIControl::service()
+{
+    PROFILE_SCOPE(ProfileService);
+
+    unsigned long elapsedMillis = millis() - m_previousMillis;
+
+    if (elapsedMillis == 0)
+        return;
+
+    m_previousMillis = millis();
+
+    applyPendingControllers(AllMidiChannels);
+
+    // Controllers affecting the attenuation are often sent in bursts (e.g. a
+    // volume sweep) so the playing notes are only updated here, at most once
+    // per millisecond
+    for (uint8_t channel = 0; m_attenuationChanged; ++ channel) {
+        if (m_attenuationChanged & (1 << channel)) {
+            m_attenuationChanged &= ~(1 << channel);
+            FOR_EACH_PLAYING_NOTE(channel, note,
+                updateAttenuation(note);
+            );
+        }
+    }
+
+    bool percussionPlaying = false;
+
+    for (int noteSlot = 0; noteSlot < MAX_PLAYING_NOTES; ++ noteSlot) {
         NoteData &note = m_playingNotes[noteSlot];
         if (note.opl3Channel != UnusedOpl3Channel) {
+            if ((note.opl3Channel >= OPL3::KickChannel)
+             || (note.midiChannel == PERCUSSION_MIDI_CHANNEL)) {
+                percussionPlaying = true;
+            }
+
             // We stop caring about note duration after 32.767 seconds (TODO: check this!)
             uint16_t newDuration = note.duration + elapsedMillis;
             if (newDuration > 32767) {
@@ -514,12 +1482,16 @@ void MIDIControl::service()
                 note.lfoTriggered = true;
                 //Serial.print(note.opl3Channel);
                 //Serial.println(" - enabling vibrato");
-                for (int op = 0; op < m_opl3.getOperatorCount(note.opl3Channel); ++ op) {
-                    if (m_channelData[note.midiChannel].operatorData[op].vibrato) {
-                        m_opl3.setVibrato(note.opl3Channel, op, true);
+                for (int op = 0; op < getChip(note).getOperatorCount(note.opl3Channel); ++ op) {
+                    OperatorPatch operatorPatch;
+
+                    getNoteOperator(note, op, operatorPatch);
+
+                    if (operatorPatch.vibrato) {
+                        getChip(note).setVibrato(note.opl3Channel, op, true);
                     }
-                    if (m_channelData[note.midiChannel].operatorData[op].tremolo) {
-                        m_opl3.setTremolo(note.opl3Channel, op, true);
+                    if (operatorPatch.tremolo) {
+                        getChip(note).setTremolo(note.opl3Channel, op, true);
                     }
                 }
             }
@@ -533,10 +1505,13 @@ void MIDIControl::service()
                 note.releaseDuration = newReleaseDuration;
 
                 uint16_t expectedReleaseDuration = 0;
-                for (int op = 0; op < m_opl3.getOperatorCount(note.opl3Channel); ++ op) {
+                for (int op = 0; op < getChip(note).getOperatorCount(note.opl3Channel); ++ op) {
                     uint16_t expectedOperatorReleaseDuration = 0;
+                    OperatorPatch operatorPatch;
 
-                    switch (m_channelData[note.midiChannel].operatorData[op].releaseRate) {
+                    getNoteOperator(note, op, operatorPatch);
+
+                    switch (operatorPatch.releaseRate) {
                         case 0:
                             // Indefinite - keep resetting the duration
                             // The note will only silence when the note slot is re-used due
@@ -586,64 +1561,578 @@ void MIDIControl::service()
             }
         }
     }
+
+    updateGlides((elapsedMillis < 0xffff) ? elapsedMillis : 0xffff);
+
+    // Let 2-op notes have the pairs of channels kept for 4-op notes back
+    // once there have been fewer 4-op notes for a while
+    if (m_fourOpDemand <= m_fourOpNoteCount) {
+        m_fourOpDemandMillis = 0;
+    } else if (elapsedMillis < FOUR_OP_DEMAND_DECAY_MILLIS - m_fourOpDemandMillis) {
+        m_fourOpDemandMillis += elapsedMillis;
+    } else {
+        -- m_fourOpDemand;
+        m_fourOpDemandMillis = 0;
+    }
+
+    // Give the channels used for percussion back to melodic notes once the
+    // percussion has been idle for a while
+    if (percussionPlaying) {
+        m_percussionIdleMillis = 0;
+    } else if (m_percussionIdleMillis < PERCUSSION_IDLE_MILLIS) {
+        if (elapsedMillis < PERCUSSION_IDLE_MILLIS - m_percussionIdleMillis) {
+            m_percussionIdleMillis += elapsedMillis;
+        } else {
+            bool disabled = true;
+
+            for (uint8_t chip = 0; chip < m_numberOfChips; ++ chip) {
+                if (!m_chips[chip]->disablePercussion()) {
+                    disabled = false;
+                }
+            }
+
+            // If a rhythm channel is still in use, try again next time
+            m_percussionIdleMillis = disabled ? PERCUSSION_IDLE_MILLIS : PERCUSSION_IDLE_MILLIS - 1;
+        }
+    }
 }
 
 void MIDIControl::stopAllNotes(
     uint8_t channel,
     bool immediate)
 {
-    uint8_t opl3Channel;
+    MonoVoice *voice = findMonoVoice(channel, false);
+    if (voice) {
+        voice->noteCount = 0;
+    }
 
-    for (int i = 0; i < OPL3::NumberOfChannels; ++ i) {
-        NoteData &note = m_playingNotes[i];
-        if ((channel == note.midiChannel) && (note.opl3Channel != UnusedOpl3Channel)) {
-            silence(note);
+    FOR_EACH_PLAYING_NOTE(channel, note,
+        silence(note);
+    );
+}
+
+MIDIControl::MonoVoice *MIDIControl::findMonoVoice(
+    uint8_t channel,
+    bool allocate)
+{
+    MonoVoice *unused = NULL;
+
+    for (uint8_t i = 0; i < MONO_VOICES; ++ i) {
+        if (!m_monoVoices[i].noteCount) {
+            if (!unused) {
+                unused = &m_monoVoices[i];
+            }
+        } else if (m_monoVoices[i].midiChannel == channel) {
+            return &m_monoVoices[i];
+        }
+    }
+
+    if ((!allocate) || (!unused)) {
+        return NULL;
+    }
+
+    unused->midiChannel = channel;
+    unused->glideStep = 0;
+
+    return unused;
+}
+
+MIDIControl::NoteData *MIDIControl::findSoundingNote(
+    uint8_t channel)
+{
+    FOR_EACH_PLAYING_NOTE(channel, note,
+        if (!note.releasing) {
+            return &note;
+        }
+    );
+
+    return NULL;
+}
+
+bool MIDIControl::playLegato(
+    uint8_t channel,
+    uint8_t note)
+{
+    // Too many channels in mono mode, so this one plays as normal
+    MonoVoice *voice = findMonoVoice(channel, true);
+    if (!voice) {
+        return false;
+    }
+
+    // The oldest held note is forgotten if there are too many
+    if (voice->noteCount == MONO_NOTE_STACK) {
+        memmove(voice->notes, voice->notes + 1, MONO_NOTE_STACK - 1);
+        -- voice->noteCount;
+    }
+
+    voice->notes[voice->noteCount ++] = note;
+
+    if (!findSoundingNote(channel)) {
+        voice->glideStep = 0;
+        return false;
+    }
+
+    glideTo(*voice, note);
+
+    return true;
+}
+
+bool MIDIControl::stopLegato(
+    uint8_t channel,
+    uint8_t note)
+{
+    MonoVoice *voice = findMonoVoice(channel, false);
+    uint8_t i;
+
+    if (!voice) {
+        return false;
+    }
+
+    for (i = 0; (i < voice->noteCount) && (voice->notes[i] != note); ++ i);
+
+    if (i == voice->noteCount) {
+        return true;
+    }
+
+    -- voice->noteCount;
+    memmove(voice->notes + i, voice->notes + i + 1, voice->noteCount - i);
+
+    // The last held note is stopped as normal (which frees the voice)
+    if (!voice->noteCount) {
+        return false;
+    }
+
+    NoteData *playingNote = findSoundingNote(channel);
+    if ((playingNote) && (playingNote->midiNote == note)) {
+        glideTo(*voice, voice->notes[voice->noteCount - 1]);
+    }
+
+    return true;
+}
+
+void MIDIControl::glideTo(
+    MonoVoice &voice,
+    uint8_t note)
+{
+    const MidiChannelData &channelData = m_channelData[voice.midiChannel];
+    uint16_t glideMillis = channelData.portamentoTime << 4;
+    NoteData *firstNote = findSoundingNote(voice.midiChannel);
+
+    if (!firstNote) {
+        return;
+    }
+
+    // Start from wherever the last glide got to
+    if (!voice.glideStep) {
+        voice.frequency = getLinearFrequency(firstNote->midiNote, channelData.pitchBend);
+    }
+
+    voice.targetFrequency = getLinearFrequency(note, channelData.pitchBend);
+    voice.glideStep = 0;
+
+    bool glide = (channelData.portamento) && (glideMillis) && (voice.frequency != voice.targetFrequency);
+
+    // All of the voices of a unison note move together
+    FOR_EACH_PLAYING_NOTE(voice.midiChannel, playingNote,
+        if (!playingNote.releasing) {
+            playingNote.midiNote = note;
+            m_sustainedNotes &= ~getNoteMask(playingNote);
+
+            if (!glide) {
+                uint32_t frequency = getNoteFrequency(note, channelData.pitchBend + getUnisonDetune(playingNote));
+                uint8_t block = OPL3::getFrequencyBlock(frequency);
+
+                getChip(playingNote).setFrequencyNumber(playingNote.opl3Channel, block,
+                                                        OPL3::getFrequencyFnum(frequency, block));
+            }
+        }
+    );
+
+    if (!glide) {
+        voice.frequency = voice.targetFrequency;
+        return;
+    }
+
+    // The only division, the glide itself is just additions
+    voice.glideStep = ((int32_t)voice.targetFrequency - (int32_t)voice.frequency) / glideMillis;
+
+    if (!voice.glideStep) {
+        voice.glideStep = (voice.targetFrequency > voice.frequency) ? 1 : -1;
+    }
+}
+
+uint32_t MIDIControl::getLinearFrequency(
+    uint8_t note,
+    int16_t cents)
+{
+    uint32_t frequency = getNoteFrequency(note, cents);
+    uint8_t block = OPL3::getFrequencyBlock(frequency);
+
+    return (uint32_t)OPL3::getFrequencyFnum(frequency, block) << (block + GLIDE_FRACTION_BITS);
+}
+
+void MIDIControl::setLinearFrequency(
+    NoteData &note,
+    uint32_t frequency)
+{
+    int16_t detune = getUnisonDetune(note);
+
+    // A cent is close enough to 38/65536 of the frequency for the few tens
+    // of cents that unison voices are detuned by
+    if (detune) {
+        frequency += ((int32_t)(frequency >> 8) * detune * 38) >> 8;
+    }
+
+    // Use the lowest block the F-number fits in, for the best accuracy
+    uint32_t fnum = frequency >> GLIDE_FRACTION_BITS;
+    uint8_t block = 0;
+
+    while ((fnum > 1023) && (block < 7)) {
+        fnum >>= 1;
+        ++ block;
+    }
+
+    getChip(note).setFrequencyNumber(note.opl3Channel, block, (fnum > 1023) ? 1023 : fnum);
+}
+
+void MIDIControl::updateGlides(
+    uint16_t elapsedMillis)
+{
+    for (uint8_t i = 0; i < MONO_VOICES; ++ i) {
+        MonoVoice &voice = m_monoVoices[i];
+        bool sounding = false;
+
+        if ((!voice.noteCount) || (!voice.glideStep)) {
+            continue;
+        }
+
+        uint32_t distance = (voice.glideStep > 0)
+                            ? voice.targetFrequency - voice.frequency
+                            : voice.frequency - voice.targetFrequency;
+        uint32_t step = (voice.glideStep > 0) ? voice.glideStep : -voice.glideStep;
+
+        if ((uint32_t)elapsedMillis * step >= distance) {
+            voice.frequency = voice.targetFrequency;
+            voice.glideStep = 0;
+        } else {
+            voice.frequency += voice.glideStep * (int32_t)elapsedMillis;
+        }
+
+        FOR_EACH_PLAYING_NOTE(voice.midiChannel, note,
+            if (!note.releasing) {
+                setLinearFrequency(note, voice.frequency);
+                sounding = true;
+            }
+        );
+
+        if (!sounding) {
+            voice.glideStep = 0;
+        }
+    }
+}
+
+int16_t MIDIControl::getUnisonDetune(
+    const NoteData &note) const
+{
+    const MidiChannelData &channelData = m_channelData[note.midiChannel];
+
+    // Percussion notes are played at a fixed note
+    if (note.midiChannel == PERCUSSION_MIDI_CHANNEL) {
+        return 0;
+    }
+
+    // Spread evenly either side of the note
+    return ((int16_t)(note.unisonVoice * 2 - channelData.unisonVoices) * channelData.unisonDetune) / 2;
+}
+
+uint8_t MIDIControl::getNoteOutputs(
+    const NoteData &note) const
+{
+    const MidiChannelData &channelData = m_channelData[note.midiChannel];
+
+    if ((!channelData.unisonSpread) || (!channelData.unisonVoices)
+     || (note.midiChannel == PERCUSSION_MIDI_CHANNEL)) {
+        return channelData.outputs;
+    }
+
+    // Same values as for panning (see setController)
+    return (note.unisonVoice & 1) ? 0x1 : 0x2;
+}
+
+void MIDIControl::updateFrequency(
+    NoteData &note)
+{
+    int16_t cents = m_channelData[note.midiChannel].pitchBend + getUnisonDetune(note);
+
+    getChip(note).setFrequency(note.opl3Channel, getNoteFrequency(note.midiNote, cents));
+}
+
+void MIDIControl::applyUserPatch(
+    uint8_t channel,
+    const UserPatch &patch)
+{
+    MidiChannelData &channelData = m_channelData[channel];
+
+    setChannelType(channel, (OPL3::ChannelType)patch.type);
+
+    channelData.feedbackModulationFactor = patch.feedbackModulationFactor;
+    channelData.synthType = patch.synthType;
+    memcpy(channelData.operatorData, patch.operators, sizeof(channelData.operatorData));
+
+    FOR_EACH_PLAYING_NOTE(channel, note,
+        uploadPatch(note);
+    );
+}
+
+void MIDIControl::uploadPatch(
+    NoteData &note)
+{
+    NoteData *notes[1] = {&note};
+
+    uploadPatch(notes, 1);
+}
+
+void MIDIControl::uploadPatch(
+    NoteData *const notes[],
+    uint8_t count)
+{
+    const NoteData &note = *notes[0];
+    const MidiChannelData &channelData = m_channelData[note.midiChannel];
+    uint8_t synthType = channelData.synthType;
+    uint8_t feedbackModulationFactor = channelData.feedbackModulationFactor;
+
+    if (note.midiChannel == PERCUSSION_MIDI_CHANNEL) {
+        BankPatch patch;
+        BankDrum drum;
+
+        getPercussionPatch(note.midiNote, patch, drum);
+
+        synthType = patch.synthType;
+        feedbackModulationFactor = patch.feedbackModulationFactor;
+    }
+
+    for (uint8_t op = 0; op < getChip(note).getOperatorCount(note.opl3Channel); ++ op) {
+        OperatorPatch operatorPatch;
+
+        getNoteOperator(note, op, operatorPatch);
+
+        // These get switched on when the LFO start delay elapses (if
+        // set for the operator)
+        if (!note.lfoTriggered) {
+            operatorPatch.tremolo = false;
+            operatorPatch.vibrato = false;
+        }
+
+        // This is written to the register as the total level, so the
+        // operator is silent until the attenuation is set below
+        operatorPatch.level = 63;
+
+        for (uint8_t i = 0; i < count; ++ i) {
+            getChip(*notes[i]).setOperatorRegisters(notes[i]->opl3Channel, op, (const uint8_t *)&operatorPatch);
+        }
+    }
+
+    // Separate per-operator loop to set the attenuation based on channel level,
+    // velocity-to-level and note velocity
+    for (uint8_t op = 0; op < getChip(note).getOperatorCount(note.opl3Channel); ++ op) {
+        uint8_t attenuation = getAttenuation(note, op);
+
+        for (uint8_t i = 0; i < count; ++ i) {
+            getChip(*notes[i]).setAttenuation(notes[i]->opl3Channel, op, attenuation);
         }
     }
+
+    for (uint8_t i = 0; i < count; ++ i) {
+        OPL3::Hardware &opl3 = getChip(*notes[i]);
+
+        opl3.setOutput(notes[i]->opl3Channel, getNoteOutputs(*notes[i]));
+        opl3.setSynthType(notes[i]->opl3Channel, synthType);
+        opl3.setFeedbackModulationFactor(notes[i]->opl3Channel, feedbackModulationFactor);
+    }
+}
+
+void MIDIControl::loadPatch(
+    uint8_t channel,
+    const BankPatch &patch)
+{
+    MidiChannelData &channelData = m_channelData[channel];
+    uint8_t operatorCount = (patch.type == OPL3::Melody4OpChannelType) ? 4 : 2;
+
+    setChannelType(channel, (OPL3::ChannelType)patch.type);
+
+    channelData.synthType = patch.synthType;
+    channelData.feedbackModulationFactor = patch.feedbackModulationFactor;
+
+    for (uint8_t op = 0; op < operatorCount; ++ op) {
+        getOperatorPatch(getPatchOperator(patch, op), channelData.operatorData[op]);
+    }
+}
+
+void MIDIControl::setChannelType(
+    uint8_t channel,
+    OPL3::ChannelType type)
+{
+    if (m_channelData[channel].type == type) {
+        return;
+    }
+
+    // Playing notes have the wrong number of operators, except for
+    // percussion notes which each have their own patch
+    if (channel != PERCUSSION_MIDI_CHANNEL) {
+        stopAllNotes(channel, true);
+    }
+
+    m_channelData[channel].type = type;
+
+    if (type == OPL3::Melody4OpChannelType) {
+        expectFourOpNote();
+    }
+}
+
+void MIDIControl::expectFourOpNote()
+{
+    if (m_fourOpDemand <= m_fourOpNoteCount) {
+        m_fourOpDemand = m_fourOpNoteCount + 1;
+    }
+
+    m_fourOpDemandMillis = 0;
 }
 
 void MIDIControl::silence(
     NoteData &note)
 {
-    m_opl3.keyOff(note.opl3Channel);
+    getChip(note).keyOff(note.opl3Channel);
 
     // Max attenuation and release rate for all operators
-    for (int op = 0; op < m_opl3.getOperatorCount(note.opl3Channel); ++ op) {
-        m_opl3.setReleaseRate(note.opl3Channel, op, 15);
-        m_opl3.setAttenuation(note.opl3Channel, op, 63);
+    for (int op = 0; op < getChip(note).getOperatorCount(note.opl3Channel); ++ op) {
+        getChip(note).setReleaseRate(note.opl3Channel, op, 15);
+        getChip(note).setAttenuation(note.opl3Channel, op, 63);
     }
 
     // Sometimes the sound is still slightly audible without doing this
-    m_opl3.setFrequency(note.opl3Channel, 0);
+    getChip(note).setFrequency(note.opl3Channel, 0);
+
+    getChip(note).freeChannel(note.opl3Channel);
+    forgetNote(note);
+}
+
+void MIDIControl::forgetNote(
+    NoteData &note)
+{
+    if (isMelodicDrum(note)) {
+        -- m_melodicDrumCount;
+    }
+
+    if (getChip(note).getChannelType(note.opl3Channel) == OPL3::Melody4OpChannelType) {
+        -- m_fourOpNoteCount;
+    }
 
-    m_opl3.freeChannel(note.opl3Channel);
+    m_channelNotes[note.midiChannel] &= ~getNoteMask(note);
+    m_sustainedNotes &= ~getNoteMask(note);
+    m_sostenutoNotes &= ~getNoteMask(note);
+#if MAX_OPL3_CHIPS > 1
+    -- m_chipNoteCount[note.chip];
+#endif
     note.clear();
     -- m_numberOfPlayingNotes;
 }
 
-void MIDIControl::updateAttenuation(
-    uint8_t channel)
+void MIDIControl::keyOffNotes(
+    NoteMask notes)
 {
-    FOR_EACH_PLAYING_NOTE(channel, note,
-        for (int op = 0; op < m_opl3.getOperatorCount(note.opl3Channel); ++ op) {
-            uint16_t operatorLevel = m_channelData[channel].operatorData[op].level;
-            uint16_t velocityToLevel = m_channelData[channel].operatorData[op].velocityToLevel;
-            uint16_t baseLevel;
-            uint16_t velocityLevelRange;
-            uint16_t level;
-
-            velocityLevelRange = (velocityToLevel * operatorLevel) / 63;
-            baseLevel = operatorLevel - velocityLevelRange;
-            level = baseLevel + (((note.velocity >> 1) * velocityLevelRange) / 63);
-            
-            // Scale level based on channel volume for carriers
-            if (m_opl3.getOperatorType(note.opl3Channel, op) == OPL3::CarrierOperatorType) {
-                level = (level * m_channelData[channel].volume) / 63;
+    m_sustainedNotes &= ~notes;
+
+    // Notes on other chips are left for their own batch
+    for (uint8_t chip = 0; (chip < m_numberOfChips) && (notes); ++ chip) {
+        NoteMask otherChips = 0;
+
+        m_chips[chip]->beginBatch();
+
+        for (NoteMask mask = notes, index = 0; mask; mask >>= 1, ++ index) {
+            if (!(mask & 1)) {
+                continue;
             }
 
-            m_opl3.setAttenuation(note.opl3Channel, op, 63 - level);
+            NoteData &note = m_playingNotes[index];
+#if MAX_OPL3_CHIPS > 1
+            if (note.chip != chip) {
+                otherChips |= getNoteMask(note);
+                continue;
+            }
+#endif
+            if (!note.releasing) {
+                m_chips[chip]->keyOff(note.opl3Channel);
+                note.releasing = true;
+            }
         }
-    );
+
+        m_chips[chip]->endBatch();
+        notes = otherChips;
+    }
+}
+
+void MIDIControl::updateAttenuation(
+    NoteData &note)
+{
+    PROFILE_SCOPE(ProfileUpdateAttenuation);
+
+    for (int op = 0; op < getChip(note).getOperatorCount(note.opl3Channel); ++ op) {
+        getChip(note).setAttenuation(note.opl3Channel, op, getAttenuation(note, op));
+    }
+}
+
+uint8_t MIDIControl::getAttenuation(
+    const NoteData &note,
+    uint8_t op) const
+{
+    const MidiChannelData &channelData = m_channelData[note.midiChannel];
+    OperatorPatch operatorPatch;
+    uint8_t operatorLevel;
+    uint8_t velocityLevelRange;
+    uint8_t level;
+
+    getNoteOperator(note, op, operatorPatch);
+
+    operatorLevel = operatorPatch.level;
+    velocityLevelRange = scaleLevel(operatorPatch.velocityToLevel, operatorLevel);
+    level = operatorLevel - velocityLevelRange;
+    level += scaleLevel(note.velocity >> 1, velocityLevelRange);
+
+    // Scale level based on channel volume for carriers, which the soft pedal
+    // also makes quieter
+    if (getChip(note).getOperatorType(note.opl3Channel, op) == OPL3::CarrierOperatorType) {
+        level = scaleLevel(level, channelData.volume);
+
+        if (channelData.soft) {
+            level = (level > SOFT_PEDAL_ATTENUATION) ? level - SOFT_PEDAL_ATTENUATION : 0;
+        }
+    }
+
+    return 63 - level;
+}
+
+void MIDIControl::getNoteOperator(
+    const NoteData &note,
+    uint8_t op,
+    OperatorPatch &operatorPatch) const
+{
+    BankPatch patch;
+    BankDrum drum;
+
+    if (note.midiChannel != PERCUSSION_MIDI_CHANNEL) {
+        operatorPatch = m_channelData[note.midiChannel].operatorData[op];
+        return;
+    }
+
+    getPercussionPatch(note.midiNote, patch, drum);
+
+    // Apart from the kick, the rhythm voices only have the one operator,
+    // which plays the patch's output operator
+    if ((drum.voice != OPL3::Melody2OpChannelType) && (drum.voice != OPL3::KickChannelType)) {
+        op = 1;
+    }
+
+    getOperatorPatch(getPatchOperator(patch, op), operatorPatch);
 }
 
 void MIDIControl::setTremolo(
@@ -661,16 +2150,16 @@ void MIDIControl::setTremolo(
         FOR_EACH_PLAYING_NOTE(channel, note,
             if (note.duration > lfoStartDelay) {
                 note.lfoTriggered = true;
-                if (operatorIndex < m_opl3.getOperatorCount(note.opl3Channel)) {
-                    m_opl3.setTremolo(note.opl3Channel, operatorIndex, true);
+                if (operatorIndex < getChip(note).getOperatorCount(note.opl3Channel)) {
+                    getChip(note).setTremolo(note.opl3Channel, operatorIndex, true);
                 }
             }
         );
     } else if ((wasEnabled) && (!enable)) {
         FOR_EACH_PLAYING_NOTE(channel, note,
             note.lfoTriggered = false;
-            if (operatorIndex < m_opl3.getOperatorCount(note.opl3Channel)) {
-                m_opl3.setTremolo(note.opl3Channel, operatorIndex, false);
+            if (operatorIndex < getChip(note).getOperatorCount(note.opl3Channel)) {
+                getChip(note).setTremolo(note.opl3Channel, operatorIndex, false);
             }
         );
     }
@@ -691,16 +2180,16 @@ void MIDIControl::setVibrato(
         FOR_EACH_PLAYING_NOTE(channel, note,
             if (note.duration > lfoStartDelay) {
                 note.lfoTriggered = true;
-                if (operatorIndex < m_opl3.getOperatorCount(note.opl3Channel)) {
-                    m_opl3.setVibrato(note.opl3Channel, operatorIndex, true);
+                if (operatorIndex < getChip(note).getOperatorCount(note.opl3Channel)) {
+                    getChip(note).setVibrato(note.opl3Channel, operatorIndex, true);
                 }
             }
         );
     } else if ((wasEnabled) && (!enable)) {
         FOR_EACH_PLAYING_NOTE(channel, note,
             note.lfoTriggered = false;
-            if (operatorIndex < m_opl3.getOperatorCount(note.opl3Channel)) {
-                m_opl3.setVibrato(note.opl3Channel, operatorIndex, false);
+            if (operatorIndex < getChip(note).getOperatorCount(note.opl3Channel)) {
+                getChip(note).setVibrato(note.opl3Channel, operatorIndex, false);
             }
         );
     }
@@ -10,13 +10,99 @@
 #define CANYON_MIDICONTROL_H 1
 
 #include "OPL3Hardware.h"
+#include "bank.h"
+#include "PatchStore.h"
 
 #define NUMBER_OF_MIDI_CHANNELS 16
 
+// General MIDI channel 10, where each note is a different percussion sound
+#define PERCUSSION_MIDI_CHANNEL 9
+
+// Controller changes waiting to be applied by service()
+#define PENDING_CONTROLLERS     16
+
+// 2-op channels kept for percussion notes which aren't played on the OPL3's
+// rhythm voices while the percussion is in use, which is also as many as can
+// play at once
+#define DRUM_VOICES             3
+
+// How long it takes for each 4-op channel kept free for 4-op notes to be
+// given back to 2-op notes, after fewer 4-op notes are playing than the most
+// that were recently
+#define FOUR_OP_DEMAND_DECAY_MILLIS 2000UL
+
+// How long rhythm mode and the DRUM_VOICES stay reserved after the last
+// percussion note has stopped, so they aren't given up between every drum hit
+#define PERCUSSION_IDLE_MILLIS  2000UL
+
+// OPL3 chips that notes can be spread across (see addChip). Each one adds a
+// note slot per OPL3 channel to the SRAM used, so there's only 1 unless more
+// are fitted. There can be at most 2, as each note slot needs a bit in a
+// 64-bit NoteMask.
+#ifndef MAX_OPL3_CHIPS
+#define MAX_OPL3_CHIPS          1
+#endif
+
+#define MAX_PLAYING_NOTES       (OPL3::NumberOfChannels * MAX_OPL3_CHIPS)
+
+// MIDI channels that can be playing in mono mode (CC126) at once, and how
+// many held notes each one remembers
+#define MONO_VOICES             4
+#define MONO_NOTE_STACK         6
+
+// Most OPL3 channels a note can be stacked on, detuned (unison)
+#define MAX_UNISON_VOICES       4
+
+// How much quieter the soft pedal (CC67) makes notes, in 0.75dB steps
+#define SOFT_PEDAL_ATTENUATION  8
+
+// Portamento glides in steps of 1/256 of an F-number (at block 0)
+#define GLIDE_FRACTION_BITS     8
+
+// Keyboard split and layer zones (see setZone). Each one takes 7 bytes of
+// SRAM; 0 leaves zones out altogether.
+#ifndef MAX_ZONES
+#define MAX_ZONES               8
+#endif
+
+// A channel's patch and the controller settings which go with it, as sent
+// in SysEx patch dumps (see SysExPatch.h)
+typedef struct __attribute__((packed)) ChannelPatch {
+    UserPatch patch;
+    unsigned outputs        : 2;
+    unsigned volume         : 6;
+    unsigned lfoStartDelay  : 4;
+    unsigned                : 4;
+} ChannelPatch;
+
+// A keyboard split or layer. Notes on the input channel within the key and
+// velocity ranges are played on the target channel, which is set to the
+// zone's program, transposed by the given number of semitones.
+typedef struct __attribute__((packed)) Zone {
+    unsigned inputChannel   : 4;
+    unsigned targetChannel  : 4;
+    unsigned lowNote        : 7;
+    unsigned enabled        : 1;
+    unsigned highNote       : 7;
+    unsigned                : 1;
+    unsigned lowVelocity    : 7;
+    unsigned                : 1;
+    unsigned highVelocity   : 7;
+    unsigned                : 1;
+    unsigned program        : 7;
+    unsigned                : 1;
+    signed transpose        : 8;
+} Zone;
+
 class MIDIControl {
     public:
         MIDIControl(OPL3::Hardware &opl3);
-        
+
+        // Adds another OPL3 for notes to be played on, which must be done
+        // before init(). Returns false if there are already MAX_OPL3_CHIPS.
+        bool addChip(
+            OPL3::Hardware &opl3);
+
         void init();
 
         void playNote(
@@ -37,9 +123,100 @@ class MIDIControl {
             uint8_t channel,
             uint16_t amount);
 
+        // Loads a General MIDI program from the patch bank. Notes already
+        // playing on the channel are not affected.
+        void setProgram(
+            uint8_t channel,
+            uint8_t program);
+
+        // Saves the channel's current patch (including any controller
+        // changes) to a user patch slot. Returns false for the percussion
+        // channel.
+        bool storePatch(
+            uint8_t channel,
+            uint8_t slot);
+
+        // Loads a user patch slot. Unlike setProgram, notes already playing
+        // on the channel change to the new patch straight away.
+        bool recallPatch(
+            uint8_t channel,
+            uint8_t slot);
+
+        void getChannelPatch(
+            uint8_t channel,
+            ChannelPatch &patch);
+
+        // Replaces the channel's patch and settings in one go, including for
+        // the notes already playing
+        bool setChannelPatch(
+            uint8_t channel,
+            const ChannelPatch &patch);
+
+        // Sets up (or, if it isn't enabled, removes) one of the MAX_ZONES
+        // zones. Once a MIDI channel is the input of a zone, its notes are
+        // only played through its zones, and its controllers and pitch bend
+        // also go to the zones' target channels. Returns false if the zone
+        // is out of range (always, if MAX_ZONES is 0).
+        bool setZone(
+            uint8_t index,
+            const Zone &zone);
+
         void service();
 
+        // Notes which took over a releasing note's OPL3 channel
+        unsigned int getVoiceStealCount() const;
+
+        // Notes which could not be played at all
+        unsigned int getDroppedNoteCount() const;
+
     private:
+        // The bodies of playNote, stopNote, setController and setPitchBend
+        // for a single MIDI channel, once any zones have been applied
+        void startNote(
+            uint8_t channel,
+            uint8_t note,
+            uint8_t velocity);
+
+        void releaseNote(
+            uint8_t channel,
+            uint8_t note);
+
+        void queueController(
+            uint8_t channel,
+            uint8_t controller,
+            uint8_t value);
+
+        void bendChannel(
+            uint8_t channel,
+            uint16_t amount);
+
+        // Target channels of the zones the channel is the input of
+        uint16_t getZoneTargets(
+            uint8_t channel) const;
+
+#if MAX_ZONES > 0
+        // Whether the note on the channel is in the zone's key range
+        bool isZoneNote(
+            const Zone &zone,
+            uint8_t channel,
+            uint8_t note) const;
+
+        // Works out m_zoneInputs from m_zones
+        void updateZoneInputs();
+#endif
+
+        // Held notes and glide of a MIDI channel in mono mode. The glide is
+        // linear in frequency, using the F-number shifted left by the block
+        // so that it's the same scale in every block.
+        typedef struct MonoVoice {
+            uint8_t midiChannel;
+            uint8_t noteCount;                  // 0 if the voice is unused
+            uint8_t notes[MONO_NOTE_STACK];     // Latest last
+            uint32_t frequency;
+            uint32_t targetFrequency;
+            int32_t glideStep;                  // Per millisecond, 0 if not gliding
+        } MonoVoice;
+
         typedef struct __attribute__((packed)) NoteData {
             void clear()
             {
@@ -50,8 +227,11 @@ class MIDIControl {
                 duration = 0;
                 releaseDuration = 0;
                 lfoTriggered = false;
-                sustained = false;
                 releasing = false;
+                unisonVoice = 0;
+#if MAX_OPL3_CHIPS > 1
+                chip = 0;
+#endif
             }
 
             unsigned midiChannel    : 4;
@@ -61,20 +241,231 @@ class MIDIControl {
             unsigned duration       : 15;   // in milliseconds
             unsigned releaseDuration: 15;
             unsigned lfoTriggered   : 1;
-            unsigned sustained      : 1;    // note off deferred from stopNote until sustain off
             unsigned releasing      : 1;
+            unsigned unisonVoice    : 2;    // Which of the note's stacked voices
+#if MAX_OPL3_CHIPS > 1
+            unsigned chip           : 2;    // Index into m_chips
+#endif
         } NoteData;
 
+#if MAX_OPL3_CHIPS > 1
+        typedef uint64_t NoteMask;
+#else
+        typedef uint32_t NoteMask;
+#endif
+
+        OPL3::Hardware &getChip(
+            const NoteData &note) const
+        {
+#if MAX_OPL3_CHIPS > 1
+            return *m_chips[note.chip];
+#else
+            (void)note;
+            return *m_chips[0];
+#endif
+        }
+
+        // Allocates a channel on the least busy chip which has one free,
+        // and sets chip to its index
+        uint8_t allocateChannel(
+            OPL3::ChannelType type,
+            uint8_t &chip);
+
+        // Switches on rhythm mode, updating or freeing any notes on channels
+        // 6, 7 and 8 depending on whether the chip could move them
+        void enablePercussion(
+            uint8_t chip);
+
         void stopAllNotes(
             uint8_t channel,
             bool immediate = false);
 
+        void loadPatch(
+            uint8_t channel,
+            const BankPatch &patch);
+
+        // Writes the note's patch to its OPL3 channel
+        void uploadPatch(
+            NoteData &note);
+
+        // As above, for notes on the same MIDI channel with the same velocity
+        // (the voices of a unison note). The registers are only worked out
+        // once.
+        void uploadPatch(
+            NoteData *const notes[],
+            uint8_t count);
+
+        // Finds a free note slot and OPL3 channel for a note on the MIDI
+        // channel, taking the channel of another note if allowed to steal.
+        // Returns NULL if there isn't one.
+        NoteData *allocateNote(
+            uint8_t channel,
+            OPL3::ChannelType type,
+            bool steal);
+
+        // Cents the note's unison voice is detuned by
+        int16_t getUnisonDetune(
+            const NoteData &note) const;
+
+        // The note's outputs, alternating between left and right for the
+        // voices of a unison note if the channel spreads them
+        uint8_t getNoteOutputs(
+            const NoteData &note) const;
+
+        // Copies a user patch into the channel data and uploads it to the
+        // channel's playing notes
+        void applyUserPatch(
+            uint8_t channel,
+            const UserPatch &patch);
+
+        // Silences the percussion notes in the choke group
+        void chokeDrums(
+            uint8_t chokeGroup);
+
+        // Silences the longest playing percussion note on a channel of the
+        // given type. Returns false if there isn't one.
+        bool stealDrum(
+            OPL3::ChannelType type);
+
+        // Whether allocating a channel of the given type for the MIDI channel
+        // would leave too few for the voices other MIDI channels have
+        // reserved, and the DRUM_VOICES for percussion
+        bool isReservedForOthers(
+            uint8_t channel,
+            OPL3::ChannelType type) const;
+
+        // True if the channel has no reserved voices, or more notes playing
+        // than it has reserved
+        bool isOverReservation(
+            uint8_t channel) const;
+
+        uint8_t getNoteCount(
+            uint8_t channel) const;
+
+        // Finds a note of the given type that a note on the MIDI channel can
+        // take the OPL3 channel of: a releasing note on a channel over its
+        // reservation or, if the MIDI channel is short of its reserved voices,
+        // the longest playing one. Returns NULL if there isn't one.
+        NoteData *findNoteToSteal(
+            uint8_t channel,
+            OPL3::ChannelType type);
+
+        // Silences the channel's longest releasing note, or longest playing
+        // one if none are releasing
+        void silenceOldestNote(
+            uint8_t channel);
+
+        bool isMelodicDrum(
+            const NoteData &note) const
+        {
+            return (note.midiChannel == PERCUSSION_MIDI_CHANNEL)
+                && (note.opl3Channel < OPL3::KickChannel);
+        }
+
+        // Changes the type of OPL3 channel the MIDI channel's notes use
+        void setChannelType(
+            uint8_t channel,
+            OPL3::ChannelType type);
+
+        // Makes sure at least one more 4-op channel than is playing is kept
+        // free
+        void expectFourOpNote();
+
+        // The channel's mono voice, or a newly allocated one if allocate is
+        // true. Returns NULL if there isn't one.
+        MonoVoice *findMonoVoice(
+            uint8_t channel,
+            bool allocate);
+
+        // The channel's first note that hasn't been released, if any
+        NoteData *findSoundingNote(
+            uint8_t channel);
+
+        // Adds the note to the mono voice's held notes and, if the channel is
+        // already sounding, changes its pitch without a new key on. Returns
+        // false if the note still has to be played.
+        bool playLegato(
+            uint8_t channel,
+            uint8_t note);
+
+        // Removes the note from the mono voice's held notes and, if any are
+        // left, goes back to the latest of them. Returns false if the note
+        // still has to be stopped.
+        bool stopLegato(
+            uint8_t channel,
+            uint8_t note);
+
+        // Moves the channel's sounding notes to a new pitch, gliding if
+        // portamento is on
+        void glideTo(
+            MonoVoice &voice,
+            uint8_t note);
+
+        // A frequency as an F-number shifted left by the block and
+        // GLIDE_FRACTION_BITS
+        static uint32_t getLinearFrequency(
+            uint8_t note,
+            int16_t cents);
+
+        // Sets the note's frequency from the above, plus its unison detune
+        void setLinearFrequency(
+            NoteData &note,
+            uint32_t frequency);
+
+        // Sets the note's frequency from its MIDI note, the pitch bend and
+        // its unison detune
+        void updateFrequency(
+            NoteData &note);
+
+        // Advances portamento glides by the elapsed time
+        void updateGlides(
+            uint16_t elapsedMillis);
+
         void silence(
             NoteData &note);
 
+        // The note's bit in m_channelNotes and the other note masks
+        NoteMask getNoteMask(
+            const NoteData &note) const
+        {
+            return (NoteMask)1 << (&note - m_playingNotes);
+        }
+
+        // Keys off the notes in the mask, in one burst of register writes
+        // for each chip
+        void keyOffNotes(
+            NoteMask notes);
+
+        // Frees the note slot without touching the OPL3
+        void forgetNote(
+            NoteData &note);
+
         void updateAttenuation(
+            NoteData &note);
+
+        // The attenuation of one of the note's operators, from the operator
+        // level, velocity and channel volume
+        uint8_t getAttenuation(
+            const NoteData &note,
+            uint8_t op) const;
+
+        // The settings of one of the note's operators: from the channel's
+        // patch, or the drum's patch in the bank for percussion notes
+        void getNoteOperator(
+            const NoteData &note,
+            uint8_t op,
+            OperatorPatch &operatorPatch) const;
+
+        // Applies and removes pending controller changes for the channel,
+        // or all of them if AllMidiChannels is given
+        void applyPendingControllers(
             uint8_t channel);
 
+        void applyController(
+            uint8_t channel,
+            uint8_t controller,
+            uint8_t value);
+
         void setTremolo(
             uint8_t channel,
             uint8_t operatorIndex,
@@ -87,13 +478,54 @@ class MIDIControl {
 
         enum {
             NoNoteSlot = -1,
-            UnusedOpl3Channel = 31
+            UnusedOpl3Channel = 31,
+            AllMidiChannels = 0xff
         };
 
-        OPL3::Hardware &m_opl3;
+        OPL3::Hardware *m_chips[MAX_OPL3_CHIPS];
+        uint8_t m_numberOfChips;
+
+#if MAX_OPL3_CHIPS > 1
+        uint8_t m_chipNoteCount[MAX_OPL3_CHIPS];
+#endif
 
         unsigned int m_numberOfPlayingNotes;
-        NoteData m_playingNotes[OPL3::NumberOfChannels];
+
+        // Percussion notes playing on 2-op or 4-op channels
+        uint8_t m_melodicDrumCount;
+
+        // 4-op notes playing, and the most that are expected to. The
+        // difference is how many 4-op channels are kept free (see
+        // allocateChannel).
+        uint8_t m_fourOpNoteCount;
+        uint8_t m_fourOpDemand;
+        uint16_t m_fourOpDemandMillis;
+        unsigned int m_voiceStealCount;
+        unsigned int m_droppedNoteCount;
+
+        // One bit per MIDI channel, set when a controller affecting the
+        // attenuation changes. Playing notes are updated by service().
+        uint16_t m_attenuationChanged;
+
+        typedef struct PendingController {
+            uint8_t channel;
+            uint8_t controller;
+            uint8_t value;
+        } PendingController;
+
+        PendingController m_pendingControllers[PENDING_CONTROLLERS];
+        uint8_t m_numberOfPendingControllers;
+        NoteData m_playingNotes[MAX_PLAYING_NOTES];
+
+        // For each MIDI channel, one bit per m_playingNotes slot in use
+        NoteMask m_channelNotes[NUMBER_OF_MIDI_CHANNELS];
+
+        // Notes whose key off has been put off by the sustain pedal or
+        // sostenuto, and notes that were held when sostenuto was pressed.
+        // These are for all MIDI channels, so are masked with the channel's
+        // m_channelNotes.
+        NoteMask m_sustainedNotes;
+        NoteMask m_sostenutoNotes;
 
         typedef struct __attribute__((packed)) MidiChannelData {
             OPL3::ChannelType type;
@@ -101,32 +533,44 @@ class MIDIControl {
             unsigned synthType      : 2;
             unsigned feedbackModulationFactor   : 3;
 
-            struct {
-                unsigned level          : 6;
-                unsigned attackRate     : 4;
-                unsigned decayRate      : 4;
-                unsigned sustainLevel   : 4;
-                unsigned releaseRate    : 4;
-                unsigned keyScaleLevel  : 2;
-                unsigned waveform       : 3;
-                unsigned frequencyMultiplicationFactor  : 4;
-                unsigned tremolo        : 1;
-                unsigned vibrato        : 1;
-                unsigned envelopeScaling : 1;
-
-                unsigned velocityToLevel : 6;   // How much velocity influences level/attenuation
-            } operatorData[4];
+            // Laid out as registers so patches can be copied from the bank
+            OperatorPatch operatorData[4];
 
             unsigned volume             : 6;
             unsigned lfoStartDelay      : 4;    // Affects vibrato/tremolo
             signed pitchBend            : 9;    // -200 to +200 cents
             unsigned sustaining         : 1;    // Sustain pedal pressed
+            unsigned sostenuto          : 1;    // Sostenuto pedal pressed
+            unsigned soft               : 1;    // Soft pedal pressed
+            unsigned reservedVoices     : 4;    // Kept free for this channel
+            unsigned maxVoices          : 5;    // Polyphony limit, 0 for none
+            unsigned mono               : 1;    // Mono mode (legato)
+            unsigned portamento         : 1;    // Glide between legato notes
+            unsigned portamentoTime     : 7;    // In 16ms units
+            unsigned unisonVoices       : 2;    // Voices per note - 1
+            unsigned unisonDetune       : 5;    // Cents between voices
+            unsigned unisonSpread       : 1;    // Alternate left and right
         } MidiChannelData;
 
         // Maybe one day we'll support multiple channels
         MidiChannelData m_channelData[NUMBER_OF_MIDI_CHANNELS];
 
+        MonoVoice m_monoVoices[MONO_VOICES];
+
+#if MAX_ZONES > 0
+        Zone m_zones[MAX_ZONES];
+
+        // One bit per MIDI channel which is the input of an enabled zone, so
+        // other channels don't need to look through the zones
+        uint16_t m_zoneInputs;
+#endif
+
         unsigned long m_previousMillis;
+
+        // Time since a percussion note last played, on MIDI channel 10 or a
+        // channel set to a percussion type (stops counting at
+        // PERCUSSION_IDLE_MILLIS)
+        uint16_t m_percussionIdleMillis;
 };
 
 #endif
@@ -0,0 +1,108 @@
+/*
+    Project:    Canyon
+    Purpose:    SRAM usage measurement
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+*/
+
+#ifdef ARDUINO
+
+#include <arduino.h>
+#include "MemoryUsage.h"
+
+// Provided by the linker and avr-libc
+extern uint8_t __data_start;
+extern uint8_t __bss_end;
+extern uint8_t __heap_start;
+extern char *__brkval;
+
+/*
+    This is placed in .init3, which runs after the stack pointer has been set
+    up but before any constructors, so nothing is using the stack yet. It is
+    naked as it is not called, the code just falls through into it.
+*/
+
+void paintStack() __attribute__((naked, used, section(".init3")));
+
+void paintStack()
+{
+    uint8_t *address = &__heap_start;
+
+    while (address <= (uint8_t *)RAMEND) {
+        *address = STACK_PAINT_VALUE;
+        ++ address;
+    }
+}
+
+static uint8_t *getHeapEnd()
+{
+    return __brkval ? (uint8_t *)__brkval : &__heap_start;
+}
+
+static uint8_t *getLowestStackAddress()
+{
+    uint8_t *address = getHeapEnd();
+
+    // Interrupts could move the stack pointer while this is running, but
+    // only ever by a few bytes
+    while ((address < (uint8_t *)SP) && (*address == STACK_PAINT_VALUE)) {
+        ++ address;
+    }
+
+    return address;
+}
+
+uint16_t getStaticMemorySize()
+{
+    return &__bss_end - &__data_start;
+}
+
+uint16_t getHeapSize()
+{
+    return getHeapEnd() - &__heap_start;
+}
+
+uint16_t getFreeMemory()
+{
+    return (uint8_t *)SP - getHeapEnd();
+}
+
+uint16_t getStackHighWaterMark()
+{
+    return (uint8_t *)RAMEND - getLowestStackAddress();
+}
+
+uint16_t getMinimumFreeMemory()
+{
+    return getLowestStackAddress() - getHeapEnd();
+}
+
+void dumpMemoryUsage(
+    Print &output)
+{
+    output.print(F("Static\t"));
+    output.println(getStaticMemorySize());
+    output.print(F("Heap\t"));
+    output.println(getHeapSize());
+    output.print(F("Stack\t"));
+    output.println((uint8_t *)RAMEND - (uint8_t *)SP);
+    output.print(F("Peak\t"));
+    output.println(getStackHighWaterMark());
+    output.print(F("Free\t"));
+    output.println(getFreeMemory());
+    output.print(F("Min\t"));
+    output.println(getMinimumFreeMemory());
+}
+
+void printObjectSize(
+    Print &output,
+    const __FlashStringHelper *name,
+    size_t size)
+{
+    output.print(name);
+    output.print('\t');
+    output.println(size);
+}
+
+#endif
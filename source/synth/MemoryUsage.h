@@ -0,0 +1,60 @@
+/*
+    Project:    Canyon
+    Purpose:    SRAM usage measurement
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    The ATmega328 only has 2KB of SRAM, shared between static data (.data
+    and .bss), the heap (which grows upwards from the end of the static data)
+    and the stack (which grows downwards from the end of RAM).
+
+    Before anything else runs, the memory between the static data and the
+    stack is filled with a known value. The lowest address which no longer
+    holds that value is as far as the stack has ever reached, so the space
+    below it (down to the heap) is the least that has ever been free.
+
+    Everything here is for the Arduino only.
+*/
+
+#ifndef CANYON_MEMORYUSAGE_H
+#define CANYON_MEMORYUSAGE_H 1
+
+#ifdef ARDUINO
+
+#include <stdint.h>
+#include <stddef.h>
+
+class Print;
+class __FlashStringHelper;
+
+#define STACK_PAINT_VALUE   0xc5
+
+// Size of .data and .bss
+uint16_t getStaticMemorySize();
+
+uint16_t getHeapSize();
+
+// Between the top of the heap and the stack pointer
+uint16_t getFreeMemory();
+
+// Deepest the stack has been
+uint16_t getStackHighWaterMark();
+
+// Between the top of the heap and the deepest the stack has been
+uint16_t getMinimumFreeMemory();
+
+// Outputs all of the above as text
+void dumpMemoryUsage(
+    Print &output);
+
+// Outputs the size of a statically allocated object, e.g.
+// printObjectSize(Serial, F("midiBuffer"), sizeof(midiBuffer))
+void printObjectSize(
+    Print &output,
+    const __FlashStringHelper *name,
+    size_t size);
+
+#endif
+
+#endif
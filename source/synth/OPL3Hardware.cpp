@@ -13,6 +13,8 @@
 #endif
 
 #include "OPL3Hardware.h"
+#include "OPL3RegisterLog.h"
+#include "Profiler.h"
 
 namespace OPL3 {
 
@@ -55,6 +57,8 @@ Hardware::Hardware(
     uint16_t ioBaseAddress)
 : m_isaBus(isaBus),
   m_ioBaseAddress(ioBaseAddress),
+  m_registerLog(NULL),
+  m_keyOnHandler(NULL),
   m_allocatedChannelBitmap(0),
   m_tremoloDepth(false),
   m_vibratoDepth(false),
@@ -170,6 +174,8 @@ void Hardware::init()
 
     // Init operators
     for (i = 0; i < 36; ++ i) {
+        m_operatorParameters[i].tremolo = false;
+        m_operatorParameters[i].vibrato = false;
         m_operatorParameters[i].sustain = false;
         m_operatorParameters[i].ksr = 0;
         m_operatorParameters[i].frequencyMultiplicationFactor = 0;
@@ -189,7 +195,8 @@ void Hardware::init()
     }
 }
 
-bool Hardware::enablePercussion()
+bool Hardware::enablePercussion(
+    uint8_t *movedChannels)
 {
     int i, j;
 
@@ -197,15 +204,6 @@ bool Hardware::enablePercussion()
         return true;
     }
 
-    // Cannot enable percussion mode while channels 6, 7 or 8 are in use.
-    for (i = 6; i <= 8; ++ i) {
-        if (isAllocatedChannel(i)) {
-            return false;
-        }
-    }
-
-    m_percussionMode = true;
-
     // TODO: Use new channel add/remove
     // Make channels 6, 7 and 8 unavailable as 2-op melody channels
     j = 0;
@@ -216,7 +214,34 @@ bool Hardware::enablePercussion()
     }
     m_numberOfFree2OpChannels = j;
 
-    return m_percussionMode;
+    // Move any voices on them out of the way
+    for (i = 6; i <= 8; ++ i) {
+        uint8_t newChannel = InvalidChannel;
+
+        if (isAllocatedChannel(i)) {
+            newChannel = moveChannel(i);
+
+            // Silence the voice (or what's left of it if it was moved)
+            m_channelParameters[i].keyOn = false;
+            commitChannelData(i, ChannelRegisterB);
+
+            for (j = 0; j < 2; ++ j) {
+                uint8_t op = getChannelOperator(i, j);
+                m_operatorParameters[op].attenuation = 63;
+                commitOperatorData(op, OperatorRegisterB);
+            }
+
+            m_allocatedChannelBitmap &= ~(1L << i);
+        }
+
+        if (movedChannels) {
+            movedChannels[i - 6] = newChannel;
+        }
+    }
+
+    m_percussionMode = true;
+
+    return commitGlobalData(GlobalRegisterF);
 }
 
 bool Hardware::disablePercussion()
@@ -225,13 +250,19 @@ bool Hardware::disablePercussion()
         return true;
     }
 
-    // Cannot disable percussion mode while any percussion is playing
-    if ((m_kickKeyOn) || (m_snareKeyOn) || (m_tomTomKeyOn) || (m_cymbalKeyOn)
-        || (m_hiHatKeyOn)) {
-        return false;
+    // Cannot disable percussion mode while any percussion channels are in use
+    for (int i = KickChannel; i <= HiHatChannel; ++ i) {
+        if (isAllocatedChannel(i)) {
+            return false;
+        }
     }
 
     m_percussionMode = false;
+    m_kickKeyOn = false;
+    m_snareKeyOn = false;
+    m_tomTomKeyOn = false;
+    m_cymbalKeyOn = false;
+    m_hiHatKeyOn = false;
 
     // TODO: Use new channel add/remove
     // Allow allocation of channels 6, 7 and 8 as 2-op melody channels
@@ -239,11 +270,47 @@ bool Hardware::disablePercussion()
         m_free2OpChannels[m_numberOfFree2OpChannels ++] = i;
     }
 
-    return !m_percussionMode;
+    return commitGlobalData(GlobalRegisterF);
+}
+
+bool Hardware::isPercussionEnabled() const
+{
+    return m_percussionMode;
+}
+
+void Hardware::setRegisterLog(
+    RegisterLog *registerLog)
+{
+    m_registerLog = registerLog;
+}
+
+void Hardware::setKeyOnHandler(
+    KeyOnHandler handler)
+{
+    m_keyOnHandler = handler;
+}
+
+void Hardware::writeRegister(
+    bool primaryRegisterSet,
+    uint8_t reg,
+    uint8_t data) const
+{
+    writeData(primaryRegisterSet, reg, data);
+}
+
+void Hardware::beginBatch() const
+{
+    m_isaBus.beginBatch();
+}
+
+void Hardware::endBatch() const
+{
+    m_isaBus.endBatch();
 }
 
 uint8_t Hardware::allocateChannel(
-    ChannelType type)
+    ChannelType type,
+    uint8_t keep4OpChannels)
 {
     uint8_t channel = InvalidChannel;
     uint8_t fourOpCapableChannels[6] = {0, 1, 2, 9, 10, 11};
@@ -258,6 +325,10 @@ uint8_t Hardware::allocateChannel(
                 uint8_t *candidates = fourOpCapableChannels;
                 uint8_t bits = 0;
 
+                if (m_numberOfFree4OpChannels <= keep4OpChannels) {
+                    break;
+                }
+
                 for (int i = 0; i < 6; ++ i) {
                     if ((getChannelType(candidates[i]) == Melody4OpChannelType) &&
                         (getChannelType(candidates[i] + 3) == NullChannelType) &&
@@ -285,8 +356,7 @@ uint8_t Hardware::allocateChannel(
 
                 break;
             } else {
-                // Take the first available channel
-                channel = shiftFreeChannel(m_free2OpChannels, m_numberOfFree2OpChannels);
+                channel = takeFree2OpChannel(keep4OpChannels);
             }
 
             break;
@@ -401,6 +471,21 @@ bool Hardware::freeChannel(
     return true;
 }
 
+uint8_t Hardware::getFreeChannelCount(
+    ChannelType type) const
+{
+    switch (type) {
+        case Melody2OpChannelType:
+            return m_numberOfFree2OpChannels;
+
+        case Melody4OpChannelType:
+            return m_numberOfFree4OpChannels;
+
+        default:
+            return 0;
+    }
+}
+
 bool Hardware::setTremoloDepth(
     bool depth)
 {
@@ -456,44 +541,54 @@ bool Hardware::setFrequency(
     uint8_t channel,
     uint32_t frequency)
 {
+    PROFILE_SCOPE(ProfileSetFrequency);
+
     uint8_t block;
     uint16_t fnum;
-    uint8_t realChannel;
+    uint8_t realChannel = getFrequencyChannel(channel);
 
-    if (!isAllocatedChannel(channel)) {
+    if (realChannel == InvalidChannel) {
         return false;
     }
 
     block = getFrequencyBlock(frequency);
     fnum = getFrequencyFnum(frequency, block);
 
-    if (isPhysicalChannel(channel)) {
-        realChannel = channel;
-    } else {
-        switch (channel) {
-            case KickChannel:
-                realChannel = 6;
-                break;
+    m_channelParameters[realChannel].frequencyNumber = fnum;
+    m_channelParameters[realChannel].block = block;
 
-            case SnareChannel:
-                realChannel = 7;
-                break;
+    return ((commitChannelData(realChannel, ChannelRegisterA)) &&
+            (commitChannelData(realChannel, ChannelRegisterB)));
+}
 
-            case TomTomChannel:
-                realChannel = 8;
-                break;
+bool Hardware::setFrequencyNumber(
+    uint8_t channel,
+    uint8_t block,
+    uint16_t fnum)
+{
+    uint8_t realChannel = getFrequencyChannel(channel);
 
-            default:
-                // Can't set frequency for HiHat or Cymbal channels
-                return false;
-        }
+    if ((realChannel == InvalidChannel) || (block > 7) || (fnum > 1023)) {
+        return false;
     }
 
-    m_channelParameters[realChannel].frequencyNumber = fnum;
-    m_channelParameters[realChannel].block = block;
+    ChannelParameters &parameters = m_channelParameters[realChannel];
+    bool lowChanged = ((parameters.frequencyNumber & 0xff) != (fnum & 0xff));
+    bool highChanged = ((parameters.block != block)
+                        || ((parameters.frequencyNumber >> 8) != (fnum >> 8)));
 
-    return ((commitChannelData(realChannel, ChannelRegisterA)) &&
-            (commitChannelData(realChannel, ChannelRegisterB)));
+    parameters.frequencyNumber = fnum;
+    parameters.block = block;
+
+    if ((lowChanged) && (!commitChannelData(realChannel, ChannelRegisterA))) {
+        return false;
+    }
+
+    if ((highChanged) && (!commitChannelData(realChannel, ChannelRegisterB))) {
+        return false;
+    }
+
+    return true;
 }
 
 bool Hardware::keyOn(
@@ -505,7 +600,9 @@ bool Hardware::keyOn(
 
     if (isPhysicalChannel(channel)) {
         m_channelParameters[channel].keyOn = true;
-        return commitChannelData(channel, ChannelRegisterB);
+        if (!commitChannelData(channel, ChannelRegisterB)) {
+            return false;
+        }
     } else {
         switch (channel) {
             case KickChannel:
@@ -532,8 +629,16 @@ bool Hardware::keyOn(
                 return false;
         }
 
-        return commitGlobalData(GlobalRegisterF);
+        if (!commitGlobalData(GlobalRegisterF)) {
+            return false;
+        }
+    }
+
+    if (m_keyOnHandler) {
+        m_keyOnHandler();
     }
+
+    return true;
 }
 
 bool Hardware::keyOff(
@@ -625,12 +730,18 @@ bool Hardware::setFeedbackModulationFactor(
     uint8_t channel,
     uint8_t factor)
 {
-    // TODO: Determine if percussion channels support this
-    if (!isPhysicalChannel(channel)) {
+    uint8_t realChannel = channel;
+
+    // The kick is the only percussion channel with a modulator, and uses
+    // channel 6's settings
+    // TODO: Determine if the other percussion channels support this
+    if (channel == KickChannel) {
+        realChannel = 6;
+    } else if (!isPhysicalChannel(channel)) {
         return false;
     }
 
-    SET_CHANNEL_VALUE(channel, channel, feedbackModulationFactor, factor, 7, ChannelRegisterC);
+    SET_CHANNEL_VALUE(channel, realChannel, feedbackModulationFactor, factor, 7, ChannelRegisterC);
 }
 
 bool Hardware::setSynthType(
@@ -641,9 +752,15 @@ bool Hardware::setSynthType(
         return false;
     }
 
-    // TODO: Percussion?
-
     switch (getChannelType(channel)) {
+        case KickChannelType:
+            if (type > 1) {
+                return false;
+            }
+
+            m_channelParameters[6].synthType = type;
+            return commitChannelData(6, ChannelRegisterC);
+
         case Melody2OpChannelType:
             if (type > 1) {
                 return false;
@@ -727,7 +844,8 @@ OperatorType Hardware::getOperatorType(
 
         case Melody2OpChannelType:
         case KickChannelType:
-            switch (m_channelParameters[channel].synthType) {
+            // The kick uses channel 6's settings
+            switch (m_channelParameters[(channel == KickChannel) ? 6 : channel].synthType) {
                 case 0:
                     switch (channelOperator) {
                         case 0:
@@ -890,7 +1008,21 @@ bool Hardware::setAttenuation(
     uint8_t channelOperator,
     uint8_t attenuation)
 {
-    SET_OPERATOR_VALUE(channel, channelOperator, attenuation, attenuation, 63, OperatorRegisterB);
+    uint8_t op;
+
+    if ((!isAllocatedChannel(channel)) || (attenuation > 63))
+        return false;
+
+    if ((op = getChannelOperator(channel, channelOperator)) == InvalidOperator)
+        return false;
+
+    // Volume changes are applied to every operator of every note on a MIDI
+    // channel, but often leave some of them as they were
+    if (m_operatorParameters[op].attenuation == attenuation)
+        return true;
+
+    m_operatorParameters[op].attenuation = attenuation;
+    return commitOperatorData(op, OperatorRegisterB);
 }
 
 bool Hardware::setWaveform(
@@ -901,6 +1033,41 @@ bool Hardware::setWaveform(
     SET_OPERATOR_VALUE(channel, channelOperator, waveform, waveform, 7, OperatorRegisterE);
 }
 
+bool Hardware::setOperatorRegisters(
+    uint8_t channel,
+    uint8_t channelOperator,
+    const uint8_t *data)
+{
+    uint8_t op;
+
+    if (!isAllocatedChannel(channel))
+        return false;
+
+    if ((op = getChannelOperator(channel, channelOperator)) == InvalidOperator)
+        return false;
+
+    OperatorParameters &parameters = m_operatorParameters[op];
+
+    parameters.tremolo = (data[0] >> 7) & 0x01;
+    parameters.vibrato = (data[0] >> 6) & 0x01;
+    parameters.sustain = (data[0] >> 5) & 0x01;
+    parameters.ksr = (data[0] >> 4) & 0x01;
+    parameters.frequencyMultiplicationFactor = data[0] & 0x0f;
+    parameters.keyScaleLevel = data[1] >> 6;
+    parameters.attenuation = data[1] & 0x3f;
+    parameters.attackRate = data[2] >> 4;
+    parameters.decayRate = data[2] & 0x0f;
+    parameters.sustainLevel = data[3] >> 4;
+    parameters.releaseRate = data[3] & 0x0f;
+    parameters.waveform = data[4] & 0x07;
+
+    return commitOperatorData(op, OperatorRegisterA)
+        && commitOperatorData(op, OperatorRegisterB)
+        && commitOperatorData(op, OperatorRegisterC)
+        && commitOperatorData(op, OperatorRegisterD)
+        && commitOperatorData(op, OperatorRegisterE);
+}
+
 bool Hardware::isValidChannel(
     uint8_t channel) const
 {
@@ -920,6 +1087,129 @@ bool Hardware::isAllocatedChannel(
             (1L << channel & m_allocatedChannelBitmap));
 }
 
+uint8_t Hardware::moveChannel(
+    uint8_t channel)
+{
+    uint8_t newChannel;
+
+    if (m_numberOfFree2OpChannels == 0) {
+        return InvalidChannel;
+    }
+
+    newChannel = shiftFreeChannel(m_free2OpChannels, m_numberOfFree2OpChannels);
+    m_allocatedChannelBitmap |= 1L << newChannel;
+
+    for (uint8_t i = 0; i < 2; ++ i) {
+        uint8_t op = getChannelOperator(newChannel, i);
+
+        m_operatorParameters[op] = m_operatorParameters[getChannelOperator(channel, i)];
+        commitOperatorData(op, OperatorRegisterA);
+        commitOperatorData(op, OperatorRegisterB);
+        commitOperatorData(op, OperatorRegisterC);
+        commitOperatorData(op, OperatorRegisterD);
+        commitOperatorData(op, OperatorRegisterE);
+    }
+
+    // Key-on is in register B, so that goes last
+    m_channelParameters[newChannel] = m_channelParameters[channel];
+    commitChannelData(newChannel, ChannelRegisterC);
+    commitChannelData(newChannel, ChannelRegisterA);
+    commitChannelData(newChannel, ChannelRegisterB);
+
+    return newChannel;
+}
+
+uint8_t Hardware::getFrequencyChannel(
+    uint8_t channel) const
+{
+    if (!isAllocatedChannel(channel)) {
+        return InvalidChannel;
+    }
+
+    if (isPhysicalChannel(channel)) {
+        return channel;
+    }
+
+    switch (channel) {
+        case KickChannel:
+            return 6;
+
+        case SnareChannel:
+            return 7;
+
+        case TomTomChannel:
+            return 8;
+
+        default:
+            // Can't set frequency for HiHat or Cymbal channels
+            return InvalidChannel;
+    }
+}
+
+uint8_t Hardware::get4OpPartner(
+    uint8_t channel) const
+{
+    if ((channel < 6) || ((channel >= 9) && (channel < 15))) {
+        return ((channel % 9) < 3) ? channel + 3 : channel - 3;
+    }
+
+    return InvalidChannel;
+}
+
+uint8_t Hardware::getFree4OpCapacity() const
+{
+    uint8_t capacity = m_numberOfFree4OpChannels;
+
+    for (uint8_t channel = 0; channel < 12; ++ channel) {
+        if (channel == 3) {
+            channel = 9;
+        }
+
+        if ((getChannelType(channel) == Melody2OpChannelType)
+         && (getChannelType(channel + 3) == Melody2OpChannelType)
+         && (!isAllocatedChannel(channel))
+         && (!isAllocatedChannel(channel + 3))) {
+            ++ capacity;
+        }
+    }
+
+    return capacity;
+}
+
+uint8_t Hardware::takeFree2OpChannel(
+    uint8_t keep4OpChannels)
+{
+    uint8_t best = 0;
+    uint8_t bestCost = 0xff;
+
+    // Cost 0: can't be part of a 4-op channel, 1: the pair is already split
+    // up, 2: splits up a pair. The earliest in the list wins a tie, so the
+    // channels are still used in turn.
+    for (uint8_t i = 0; (i < m_numberOfFree2OpChannels) && (bestCost > 0); ++ i) {
+        uint8_t partner = get4OpPartner(m_free2OpChannels[i]);
+        uint8_t cost = 0;
+
+        if (partner != InvalidChannel) {
+            cost = ((getChannelType(partner) == Melody2OpChannelType)
+                    && (!isAllocatedChannel(partner))) ? 2 : 1;
+        }
+
+        if (cost < bestCost) {
+            best = i;
+            bestCost = cost;
+        }
+    }
+
+    if ((bestCost == 2) && (getFree4OpCapacity() <= keep4OpChannels)) {
+        return InvalidChannel;
+    }
+
+    uint8_t channel = m_free2OpChannels[best];
+    removeFreeChannel(m_free2OpChannels, m_numberOfFree2OpChannels, channel);
+
+    return channel;
+}
+
 uint8_t Hardware::shiftFreeChannel(
     uint8_t *list,
     uint8_t &freeCount)
@@ -1171,6 +1461,10 @@ void Hardware::writeData(
 
     m_isaBus.write(address, reg);
     m_isaBus.write(address + 1, data);
+
+    if (m_registerLog) {
+        m_registerLog->record(primaryRegisterSet, reg, data);
+    }
 }
 
 }
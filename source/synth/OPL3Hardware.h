@@ -10,10 +10,15 @@
 #define CANYON_OPL3HARDWARE_H 1
 
 #include <stdint.h>
+#include <stddef.h>
 #include "ISABus.h"
 
 namespace OPL3 {
 
+class RegisterLog;
+
+typedef void (*KeyOnHandler)();
+
 enum {
     InvalidChannel  = 0xff,
     InvalidOperator = 0xff,
@@ -119,16 +124,57 @@ class Hardware {
 
         void init();
 
-        bool enablePercussion();
+        // Channels 6, 7 and 8 become the percussion channels. Any melodic
+        // voices on them are moved to free 2-op channels (restarting their
+        // envelopes), or silenced and freed if there aren't enough. If
+        // movedChannels is given, it's set to where the voices on channels 6,
+        // 7 and 8 went, or InvalidChannel if they were silenced.
+        bool enablePercussion(
+            uint8_t *movedChannels = NULL);
 
+        // Fails while any of the percussion channels are allocated
         bool disablePercussion();
 
+        bool isPercussionEnabled() const;
+
+        // Every register write is recorded while a log is attached (pass
+        // NULL to detach)
+        void setRegisterLog(
+            RegisterLog *registerLog);
+
+        // Called once a key-on has been written to the OPL3 (pass NULL to
+        // remove)
+        void setKeyOnHandler(
+            KeyOnHandler handler);
+
+        // Raw register access, for playing back register logs. This bypasses
+        // the channel/operator state, so init() should be called afterwards.
+        void writeRegister(
+            bool primaryRegisterSet,
+            uint8_t reg,
+            uint8_t data) const;
+
+        // Register writes made between these are sent as one continuous
+        // burst on the ISA bus
+        void beginBatch() const;
+
+        void endBatch() const;
+
+        // A 2-op channel is only taken from a pair that could become a 4-op
+        // channel when there's no other choice, and then only if more than
+        // keep4OpChannels 4-op channels could still be allocated
         uint8_t allocateChannel(
-            ChannelType type);
+            ChannelType type,
+            uint8_t keep4OpChannels = 0);
 
         bool freeChannel(
             uint8_t channel);
 
+        // Number of 2-op or 4-op melody channels that could be allocated
+        // without converting any channels between the two
+        uint8_t getFreeChannelCount(
+            ChannelType type) const;
+
         // Global
         
         bool setTremoloDepth(
@@ -146,6 +192,13 @@ class Hardware {
             uint8_t channel,
             uint32_t frequency);
 
+        // Sets the block and F-number directly, only writing the registers
+        // that change (usually just 0xa0 while gliding between notes)
+        bool setFrequencyNumber(
+            uint8_t channel,
+            uint8_t block,
+            uint16_t fnum);
+
         bool keyOn(
             uint8_t channel);
 
@@ -233,6 +286,13 @@ class Hardware {
             uint8_t channelOperator,
             uint8_t waveform);
 
+        // Sets all of an operator's parameters from the values of registers
+        // 0x20, 0x40, 0x60, 0x80 and 0xe0 (in that order)
+        bool setOperatorRegisters(
+            uint8_t channel,
+            uint8_t channelOperator,
+            const uint8_t *data);
+
     private:
         bool isValidChannel(
             uint8_t channel) const;
@@ -243,6 +303,30 @@ class Hardware {
         bool isAllocatedChannel(
             uint8_t channel) const;
 
+        // The physical channel holding the frequency of an allocated channel,
+        // or InvalidChannel (the hi-hat and cymbal don't have their own)
+        uint8_t getFrequencyChannel(
+            uint8_t channel) const;
+
+        // Moves a 2-op channel's settings to a free 2-op channel, which is
+        // returned (or InvalidChannel if there are none)
+        uint8_t moveChannel(
+            uint8_t channel);
+
+        // The other channel of a 4-op capable pair (0 and 3, 1 and 4, 2 and
+        // 5, 9 and 12, 10 and 13 or 11 and 14), or InvalidChannel
+        uint8_t get4OpPartner(
+            uint8_t channel) const;
+
+        // Free 4-op channels plus pairs of free 2-op channels which could
+        // become one
+        uint8_t getFree4OpCapacity() const;
+
+        // Takes the free 2-op channel which leaves the most pairs able to
+        // become 4-op channels (see allocateChannel)
+        uint8_t takeFree2OpChannel(
+            uint8_t keep4OpChannels);
+
         uint8_t shiftFreeChannel(
             uint8_t *list,
             uint8_t &freeCount);
@@ -286,6 +370,9 @@ class Hardware {
         ISABus &m_isaBus;
         uint16_t m_ioBaseAddress;
 
+        RegisterLog *m_registerLog;
+        KeyOnHandler m_keyOnHandler;
+
         // Each bit represents whether a channel has been allocated or not
         // OPL3 provides 18 channels, but some additional ones are allocated
         // here to cater for percussion
@@ -0,0 +1,298 @@
+/*
+    Project:    Canyon
+    Purpose:    OPL3 register write capture
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    DRO v2 files start with a header, followed by a "codemap" which translates
+    an index (0-127) into a register number, allowing each register write to
+    be stored as a pair of bytes. The top bit of the index selects the
+    secondary register set. Two indexes are reserved as delay codes.
+*/
+
+#ifdef ARDUINO
+    #include <arduino.h>
+#else
+    #include "prototype/Timing.h"
+#endif
+
+#include "OPL3RegisterLog.h"
+
+namespace OPL3 {
+
+enum {
+    DROHardwareOPL3     = 2,
+    DROShortDelayCode   = 0x7e,     // Delay for (data + 1) ms
+    DROLongDelayCode    = 0x7f,     // Delay for (data + 1) * 256 ms
+
+    // Number of codemap entries (see getDRORegister)
+    DROCodemapLength    = 7 + (5 * 18) + (3 * 9)
+};
+
+// The codemap only covers registers that Hardware writes to
+static uint8_t getDRORegister(
+    uint8_t index)
+{
+    const uint8_t globalRegisters[7] = {
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x08, 0xbd
+    };
+    const uint8_t operatorRegisters[5] = {
+        0x20, 0x40, 0x60, 0x80, 0xe0
+    };
+    uint8_t slot;
+
+    if (index < 7) {
+        return globalRegisters[index];
+    }
+
+    index -= 7;
+
+    if (index < 5 * 18) {
+        // Operator registers have gaps after every 6 operators
+        slot = index % 18;
+        return operatorRegisters[index / 18] | (slot + ((slot / 6) * 2));
+    }
+
+    index -= 5 * 18;
+
+    if (index < 3 * 9) {
+        return (0xa0 + ((index / 9) * 0x10)) | (index % 9);
+    }
+
+    return 0xff;
+}
+
+static uint8_t getDROIndex(
+    uint8_t reg)
+{
+    for (uint8_t index = 0; index < DROCodemapLength; ++ index) {
+        if (getDRORegister(index) == reg) {
+            return index;
+        }
+    }
+
+    return 0xff;
+}
+
+// Registers outside of the codemap are not written by Hardware, so they
+// shouldn't turn up. If they do, they are skipped (but the delay is kept).
+static uint8_t getPairCount(
+    const RegisterWrite &write)
+{
+    return (write.delay >= 256 ? 1 : 0)
+         + ((write.delay & 0xff) ? 1 : 0)
+         + (getDROIndex(write.reg) != 0xff ? 1 : 0);
+}
+
+RegisterLog::RegisterLog()
+: m_previousMillis(millis()),
+  m_output(NULL),
+#ifdef ARDUINO
+  m_writeIndex(0),
+  m_usage(0)
+#else
+  m_lengthPairs(0),
+  m_lengthMillis(0)
+#endif
+{
+}
+
+void RegisterLog::record(
+    bool primaryRegisterSet,
+    uint8_t reg,
+    uint8_t data)
+{
+    RegisterWrite write;
+
+#ifndef ARDUINO
+    if (!m_output) {
+        return;
+    }
+#endif
+
+    write.delay = getElapsedMillis();
+    write.secondaryRegisterSet = !primaryRegisterSet;
+    write.reg = reg;
+    write.data = data;
+
+#ifdef ARDUINO
+    // When full, the oldest write is overwritten
+    m_buffer[m_writeIndex] = write;
+
+    if (++ m_writeIndex == REGISTER_LOG_SIZE) {
+        m_writeIndex = 0;
+    }
+
+    if (m_usage < REGISTER_LOG_SIZE) {
+        ++ m_usage;
+    }
+#else
+    writeDelay(write.delay);
+    writeRegister(write);
+
+    m_lengthPairs += getPairCount(write);
+    m_lengthMillis += write.delay;
+#endif
+}
+
+#ifdef ARDUINO
+
+void RegisterLog::clear()
+{
+    m_writeIndex = 0;
+    m_usage = 0;
+}
+
+void RegisterLog::dump(
+    Print &output)
+{
+    uint8_t readIndex = (m_writeIndex + REGISTER_LOG_SIZE - m_usage) % REGISTER_LOG_SIZE;
+    uint32_t lengthPairs = 0;
+    uint32_t lengthMillis = 0;
+    uint8_t i;
+
+    m_output = &output;
+
+    // The header needs the totals, so they are worked out up-front
+    for (i = 0; i < m_usage; ++ i) {
+        const RegisterWrite &write = m_buffer[(readIndex + i) % REGISTER_LOG_SIZE];
+        lengthPairs += getPairCount(write);
+        lengthMillis += write.delay;
+    }
+
+    writeHeader(lengthPairs, lengthMillis);
+
+    for (i = 0; i < m_usage; ++ i) {
+        const RegisterWrite &write = m_buffer[(readIndex + i) % REGISTER_LOG_SIZE];
+        writeDelay(write.delay);
+        writeRegister(write);
+    }
+
+    m_output = NULL;
+    clear();
+}
+
+#else
+
+bool RegisterLog::open(
+    const char *path)
+{
+    close();
+
+    m_output = fopen(path, "wb");
+    if (!m_output) {
+        return false;
+    }
+
+    m_lengthPairs = 0;
+    m_lengthMillis = 0;
+    m_previousMillis = millis();
+
+    // The lengths are filled in by close()
+    writeHeader(0, 0);
+
+    return true;
+}
+
+void RegisterLog::close()
+{
+    if (!m_output) {
+        return;
+    }
+
+    fseek(m_output, 0, SEEK_SET);
+    writeHeader(m_lengthPairs, m_lengthMillis);
+
+    fclose(m_output);
+    m_output = NULL;
+}
+
+#endif
+
+uint16_t RegisterLog::getElapsedMillis()
+{
+    unsigned long now = millis();
+    unsigned long elapsed = now - m_previousMillis;
+
+    m_previousMillis = now;
+
+    // Anything longer than this is shortened (should be rare)
+    return elapsed < 0x7fff ? elapsed : 0x7fff;
+}
+
+void RegisterLog::writeHeader(
+    uint32_t lengthPairs,
+    uint32_t lengthMillis)
+{
+    const char *signature = "DBRAWOPL";
+    uint8_t i;
+
+    for (i = 0; i < 8; ++ i) {
+        writeByte(signature[i]);
+    }
+
+    // Version 2.0
+    writeByte(0x02);
+    writeByte(0x00);
+    writeByte(0x00);
+    writeByte(0x00);
+
+    for (i = 0; i < 4; ++ i) {
+        writeByte((lengthPairs >> (i * 8)) & 0xff);
+    }
+
+    for (i = 0; i < 4; ++ i) {
+        writeByte((lengthMillis >> (i * 8)) & 0xff);
+    }
+
+    writeByte(DROHardwareOPL3);
+    writeByte(0);   // Interleaved format
+    writeByte(0);   // No compression
+    writeByte(DROShortDelayCode);
+    writeByte(DROLongDelayCode);
+    writeByte(DROCodemapLength);
+
+    for (i = 0; i < DROCodemapLength; ++ i) {
+        writeByte(getDRORegister(i));
+    }
+}
+
+void RegisterLog::writeDelay(
+    uint16_t delay)
+{
+    if (delay >= 256) {
+        writeByte(DROLongDelayCode);
+        writeByte((delay >> 8) - 1);
+    }
+
+    if (delay & 0xff) {
+        writeByte(DROShortDelayCode);
+        writeByte((delay & 0xff) - 1);
+    }
+}
+
+void RegisterLog::writeRegister(
+    const RegisterWrite &write)
+{
+    uint8_t index = getDROIndex(write.reg);
+
+    if (index == 0xff) {
+        return;
+    }
+
+    writeByte(index | (write.secondaryRegisterSet ? 0x80 : 0x00));
+    writeByte(write.data);
+}
+
+void RegisterLog::writeByte(
+    uint8_t data)
+{
+#ifdef ARDUINO
+    m_output->write(data);
+#else
+    fputc(data, m_output);
+#endif
+}
+
+}
@@ -0,0 +1,98 @@
+/*
+    Project:    Canyon
+    Purpose:    OPL3 register write capture
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    Attach a RegisterLog to OPL3::Hardware to record every register write
+    along with the number of milliseconds since the previous one.
+
+    Captures are exported in the DOSBox Raw OPL (DRO) v2 format, so they can
+    be played back by existing tools as well as diffed between firmware
+    versions.
+
+    On the Arduino, writes are kept in a small ring (the oldest are discarded
+    when it fills up) which can be dumped as a complete DRO file. On the host,
+    writes go straight to a file.
+*/
+
+#ifndef CANYON_OPL3REGISTERLOG_H
+#define CANYON_OPL3REGISTERLOG_H 1
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+    class Print;
+#else
+    #include <cstdio>
+#endif
+
+#define REGISTER_LOG_SIZE   64
+
+namespace OPL3 {
+
+typedef struct RegisterWrite {
+    unsigned delay                  : 15;   // in milliseconds
+    unsigned secondaryRegisterSet   : 1;
+    uint8_t reg;
+    uint8_t data;
+} RegisterWrite;
+
+class RegisterLog {
+    public:
+        RegisterLog();
+
+        void record(
+            bool primaryRegisterSet,
+            uint8_t reg,
+            uint8_t data);
+
+#ifdef ARDUINO
+        void clear();
+
+        // Writes the captured data as a DRO file and then clears it
+        void dump(
+            Print &output);
+#else
+        bool open(
+            const char *path);
+
+        void close();
+#endif
+
+    private:
+        uint16_t getElapsedMillis();
+
+        void writeHeader(
+            uint32_t lengthPairs,
+            uint32_t lengthMillis);
+
+        void writeDelay(
+            uint16_t delay);
+
+        void writeRegister(
+            const RegisterWrite &write);
+
+        void writeByte(
+            uint8_t data);
+
+        unsigned long m_previousMillis;
+
+#ifdef ARDUINO
+        Print *m_output;
+
+        RegisterWrite m_buffer[REGISTER_LOG_SIZE];
+        uint8_t m_writeIndex;
+        uint8_t m_usage;
+#else
+        FILE *m_output;
+
+        uint32_t m_lengthPairs;
+        uint32_t m_lengthMillis;
+#endif
+};
+
+}
+
+#endif
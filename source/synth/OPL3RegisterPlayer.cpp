@@ -0,0 +1,538 @@
+/*
+    Project:    Canyon
+    Purpose:    OPL3 register log playback
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    Each format is decoded one byte at a time. m_position is the offset of
+    the current byte from the start of the data, which is used to pick out
+    header fields. Records are collected in m_record until complete.
+
+    Delays are added to a timeline measured in the format's own tick rate
+    (e.g. 44100Hz for VGM) and converted to milliseconds when a write is
+    queued, so that rounding errors don't accumulate.
+*/
+
+#ifdef ARDUINO
+    #include <arduino.h>
+#else
+    #include "prototype/Timing.h"
+#endif
+
+#include "OPL3RegisterPlayer.h"
+
+namespace OPL3 {
+
+enum {
+    // Queued entries for this register only carry a delay
+    NoRegister  = 0x00,
+
+    MaxDelay    = 0x7fff
+};
+
+static uint8_t getVGMOperandLength(
+    uint8_t command)
+{
+    if ((command >= 0x30) && (command <= 0x3f)) {
+        return 1;
+    } else if ((command >= 0x40) && (command <= 0x4e)) {
+        return 2;
+    } else if ((command == 0x4f) || (command == 0x50)) {
+        return 1;
+    } else if ((command >= 0x51) && (command <= 0x5f)) {
+        return 2;
+    } else if (command == 0x61) {
+        return 2;
+    } else if (command == 0x67) {
+        return 6;
+    } else if (command == 0x68) {
+        return 11;
+    } else if ((command == 0x90) || (command == 0x91) || (command == 0x95)) {
+        return 4;
+    } else if (command == 0x92) {
+        return 5;
+    } else if (command == 0x93) {
+        return 10;
+    } else if (command == 0x94) {
+        return 1;
+    } else if ((command >= 0xa0) && (command <= 0xbf)) {
+        return 2;
+    } else if ((command >= 0xc0) && (command <= 0xdf)) {
+        return 3;
+    } else if (command >= 0xe0) {
+        return 4;
+    }
+
+    // Waits, end of data, and anything unknown
+    return 0;
+}
+
+RegisterPlayer::RegisterPlayer(
+    Hardware &opl3)
+: m_opl3(opl3),
+  m_format(DROFormat),
+  m_playing(false),
+  m_inputEnded(false),
+  m_hasLength(false)
+{
+}
+
+void RegisterPlayer::begin(
+    RegisterLogFormat format)
+{
+    m_format = format;
+
+    m_playing = true;
+    m_inputEnded = false;
+    m_hasLength = false;
+
+    m_position = 0;
+    m_recordLength = 0;
+    m_recordPosition = 0;
+    m_skip = 0;
+    m_remaining = 0;
+
+    m_dataOffset = 0x40;
+    m_shortDelayCode = 0xff;
+    m_longDelayCode = 0xff;
+    m_codemapLength = 0;
+
+    switch (format) {
+        case DROFormat:
+            m_tickRate = 1000;
+            break;
+
+        case VGMFormat:
+            m_tickRate = 44100;
+            break;
+
+        case IMFFormat:
+            m_tickRate = 560;
+            break;
+
+        case IMF700Format:
+            m_tickRate = 700;
+            break;
+    };
+
+    m_ticks = 0;
+    m_seconds = 0;
+    m_queuedMillis = 0;
+
+    m_readIndex = 0;
+    m_writeIndex = 0;
+    m_usage = 0;
+
+    m_scheduledMillis = millis();
+}
+
+bool RegisterPlayer::put(
+    uint8_t data)
+{
+    if ((!m_playing) || (m_inputEnded)) {
+        // Discard
+        return true;
+    }
+
+    // A single byte can result in a write being queued, after the delay
+    // leading up to it. Any of that delay too long for the write's own
+    // entry is queued first, so the byte is refused until there's space for
+    // all of it.
+    if ((!queueLongDelays(1)) || (m_usage == REGISTER_PLAYER_QUEUE_SIZE)) {
+        return false;
+    }
+
+    if (m_skip > 0) {
+        -- m_skip;
+    } else {
+        switch (m_format) {
+            case DROFormat:
+                putDRO(data);
+                break;
+
+            case VGMFormat:
+                putVGM(data);
+                break;
+
+            case IMFFormat:
+            case IMF700Format:
+                putIMF(data);
+                break;
+        };
+    }
+
+    ++ m_position;
+
+    return true;
+}
+
+void RegisterPlayer::end()
+{
+    m_inputEnded = true;
+}
+
+void RegisterPlayer::service()
+{
+    unsigned long now = millis();
+    bool batching = false;
+
+    if (!m_playing) {
+        return;
+    }
+
+    if ((m_inputEnded) && (m_usage == 0)) {
+        if (getTimelineMillis() == m_queuedMillis) {
+            m_playing = false;
+            return;
+        }
+
+        // Wait for the time after the final write to elapse too
+        if (queueLongDelays(1)) {
+            queueWrite(true, NoRegister, 0);
+        }
+    }
+
+    while (m_usage > 0) {
+        const RegisterWrite &write = m_queue[m_readIndex];
+
+        if ((long)(now - m_scheduledMillis) < (long)write.delay) {
+            break;
+        }
+
+        // Scheduling is relative to when the previous write was due rather
+        // than when it happened, so playback catches up if it falls behind
+        m_scheduledMillis += write.delay;
+
+        if (write.reg != NoRegister) {
+            if (!batching) {
+                m_opl3.beginBatch();
+                batching = true;
+            }
+
+            m_opl3.writeRegister(!write.secondaryRegisterSet, write.reg, write.data);
+        }
+
+        if (++ m_readIndex == REGISTER_PLAYER_QUEUE_SIZE) {
+            m_readIndex = 0;
+        }
+
+        -- m_usage;
+    }
+
+    if (batching) {
+        m_opl3.endBatch();
+    }
+}
+
+bool RegisterPlayer::isPlaying() const
+{
+    return m_playing;
+}
+
+/*
+    DRO v2
+
+    0   "DBRAWOPL"
+    8   Version (major, minor - 16 bits each)
+    12  Length in register/value pairs (32 bits)
+    16  Length in milliseconds (32 bits)
+    20  Hardware type
+    21  Format (0 = interleaved)
+    22  Compression (0 = none)
+    23  Short delay code
+    24  Long delay code
+    25  Codemap length
+    26  Codemap
+*/
+
+void RegisterPlayer::putDRO(
+    uint8_t data)
+{
+    const char *signature = "DBRAWOPL";
+
+    if (m_position < 8) {
+        if (data != (uint8_t)signature[m_position]) {
+            m_inputEnded = true;
+        }
+    } else if (m_position < 26) {
+        switch (m_position) {
+            case 8:
+            case 21:
+            case 22:
+                // Only uncompressed, interleaved version 2 data is supported
+                if (data != (m_position == 8 ? 2 : 0)) {
+                    m_inputEnded = true;
+                }
+                break;
+
+            case 12:
+            case 13:
+            case 14:
+            case 15:
+                m_remaining |= (uint32_t)data << ((m_position - 12) * 8);
+                m_hasLength = true;
+                break;
+
+            case 23:
+                m_shortDelayCode = data;
+                break;
+
+            case 24:
+                m_longDelayCode = data;
+                break;
+
+            case 25:
+                m_codemapLength = data < 128 ? data : 128;
+
+                if (m_remaining == 0) {
+                    m_inputEnded = true;
+                }
+                break;
+        };
+    } else if (m_position < (uint32_t)26 + m_codemapLength) {
+        m_codemap[m_position - 26] = data;
+    } else {
+        m_record[m_recordPosition ++] = data;
+
+        if (m_recordPosition < 2) {
+            return;
+        }
+
+        m_recordPosition = 0;
+
+        if (m_record[0] == m_shortDelayCode) {
+            addDelay(m_record[1] + 1);
+        } else if (m_record[0] == m_longDelayCode) {
+            addDelay((m_record[1] + 1) << 8);
+        } else if ((m_record[0] & 0x7f) < m_codemapLength) {
+            queueWrite(!(m_record[0] & 0x80), m_codemap[m_record[0] & 0x7f], m_record[1]);
+        }
+
+        if ((m_hasLength) && (-- m_remaining == 0)) {
+            m_inputEnded = true;
+        }
+    }
+}
+
+/*
+    VGM
+
+    0       "Vgm "
+    0x34    Offset of the data, relative to 0x34 (version 1.50 onwards)
+    0x40    Data (earlier versions)
+*/
+
+void RegisterPlayer::putVGM(
+    uint8_t data)
+{
+    const char *signature = "Vgm ";
+    uint32_t dataOffset;
+
+    if (m_position < m_dataOffset) {
+        if (m_position < 4) {
+            if (data != (uint8_t)signature[m_position]) {
+                m_inputEnded = true;
+            }
+        } else if ((m_position >= 0x34) && (m_position < 0x38)) {
+            m_record[m_position - 0x34] = data;
+
+            if (m_position == 0x37) {
+                dataOffset = (uint32_t)m_record[0]
+                           | ((uint32_t)m_record[1] << 8)
+                           | ((uint32_t)m_record[2] << 16)
+                           | ((uint32_t)m_record[3] << 24);
+
+                // This is 0 for versions before 1.50
+                if (dataOffset >= 4) {
+                    m_dataOffset = 0x34 + dataOffset;
+                }
+            }
+        }
+
+        return;
+    }
+
+    if (m_recordPosition == 0) {
+        m_recordLength = getVGMOperandLength(data) + 1;
+
+        // Commands for other chips are skipped
+        if ((data != 0x61) && (data != 0x67) && ((data < 0x5a) || (data > 0x5f))) {
+            m_skip = m_recordLength - 1;
+            m_recordLength = 1;
+        }
+    }
+
+    m_record[m_recordPosition ++] = data;
+
+    if (m_recordPosition < m_recordLength) {
+        return;
+    }
+
+    m_recordPosition = 0;
+
+    switch (m_record[0]) {
+        case 0x5a:  // YM3812
+        case 0x5b:  // YM3526
+        case 0x5c:  // Y8950
+        case 0x5e:  // YMF262 port 0
+            queueWrite(true, m_record[1], m_record[2]);
+            break;
+
+        case 0x5f:  // YMF262 port 1
+            queueWrite(false, m_record[1], m_record[2]);
+            break;
+
+        case 0x61:
+            addDelay(m_record[1] | (m_record[2] << 8));
+            break;
+
+        case 0x62:
+            addDelay(735);
+            break;
+
+        case 0x63:
+            addDelay(882);
+            break;
+
+        case 0x66:
+            m_inputEnded = true;
+            break;
+
+        case 0x67:
+            // Data block - 0x66, type, then a 32-bit size
+            m_skip = ((uint32_t)m_record[3]
+                   | ((uint32_t)m_record[4] << 8)
+                   | ((uint32_t)m_record[5] << 16)
+                   | ((uint32_t)m_record[6] << 24)) & 0x7fffffff;
+            break;
+
+        default:
+            if ((m_record[0] >= 0x70) && (m_record[0] <= 0x7f)) {
+                addDelay((m_record[0] & 0x0f) + 1);
+            } else if ((m_record[0] >= 0x80) && (m_record[0] <= 0x8f)) {
+                // YM2612 DAC write followed by a wait
+                addDelay(m_record[0] & 0x0f);
+            }
+            break;
+    };
+}
+
+/*
+    IMF
+
+    Type 0 files consist only of 4-byte records. Type 1 files start with the
+    length of the data in bytes (16 bits). These can be told apart because
+    type 0 files always start with an empty record.
+
+    Each record is a register, value and the number of ticks to wait before
+    the next record (16 bits). Only the primary register set is used.
+*/
+
+void RegisterPlayer::putIMF(
+    uint8_t data)
+{
+    m_record[m_recordPosition ++] = data;
+
+    if ((m_position == 1) && (m_record[0] | m_record[1])) {
+        m_remaining = (m_record[0] | (m_record[1] << 8)) / 4;
+        m_hasLength = true;
+        m_recordPosition = 0;
+
+        if (m_remaining == 0) {
+            m_inputEnded = true;
+        }
+        return;
+    }
+
+    if (m_recordPosition < 4) {
+        return;
+    }
+
+    m_recordPosition = 0;
+
+    queueWrite(true, m_record[0], m_record[1]);
+    addDelay(m_record[2] | (m_record[3] << 8));
+
+    if ((m_hasLength) && (-- m_remaining == 0)) {
+        m_inputEnded = true;
+    }
+}
+
+void RegisterPlayer::addDelay(
+    uint32_t ticks)
+{
+    ticks += m_ticks;
+
+    while (ticks >= m_tickRate) {
+        ticks -= m_tickRate;
+        ++ m_seconds;
+    }
+
+    m_ticks = ticks;
+}
+
+uint32_t RegisterPlayer::getTimelineMillis() const
+{
+    return (m_seconds * 1000) + (((uint32_t)m_ticks * 1000) / m_tickRate);
+}
+
+void RegisterPlayer::queueWrite(
+    bool primaryRegisterSet,
+    uint8_t reg,
+    uint8_t data)
+{
+    RegisterWrite write;
+    uint32_t timelineMillis = getTimelineMillis();
+    uint32_t delay = timelineMillis - m_queuedMillis;
+
+    m_queuedMillis = timelineMillis;
+
+    // Anything longer has already been queued by queueLongDelays
+    write.delay = delay;
+    write.secondaryRegisterSet = !primaryRegisterSet;
+    write.reg = reg;
+    write.data = data;
+    queue(write);
+}
+
+bool RegisterPlayer::queueLongDelays(
+    uint8_t reserve)
+{
+    RegisterWrite write;
+
+    write.delay = MaxDelay;
+    write.secondaryRegisterSet = false;
+    write.reg = NoRegister;
+    write.data = 0;
+
+    while (getTimelineMillis() - m_queuedMillis > MaxDelay) {
+        if (m_usage + reserve >= REGISTER_PLAYER_QUEUE_SIZE) {
+            return false;
+        }
+
+        queue(write);
+        m_queuedMillis += MaxDelay;
+    }
+
+    return true;
+}
+
+void RegisterPlayer::queue(
+    const RegisterWrite &write)
+{
+    // put() and service() make sure there's space
+    if (m_usage == REGISTER_PLAYER_QUEUE_SIZE) {
+        return;
+    }
+
+    m_queue[m_writeIndex] = write;
+
+    if (++ m_writeIndex == REGISTER_PLAYER_QUEUE_SIZE) {
+        m_writeIndex = 0;
+    }
+
+    ++ m_usage;
+}
+
+}
@@ -0,0 +1,139 @@
+/*
+    Project:    Canyon
+    Purpose:    OPL3 register log playback
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    Plays back register logs by writing straight to OPL3::Hardware, without
+    any involvement from MIDIControl. The following formats are supported:
+
+    DRO     DOSBox Raw OPL, version 2 only
+    VGM     YMF262 and YM3812 commands (other chips are skipped). Compressed
+            (.vgz) files must be decompressed first.
+    IMF     id Software Music Format, at 560Hz or 700Hz. Type 1 files are
+            detected by their length prefix.
+
+    Data is supplied a byte at a time via put(), so it can come from a file
+    or be streamed in over serial. This is decoded into a queue of timed
+    register writes, which are sent to the OPL3 by service() as they become
+    due. All writes that are due at the same time are sent as one batch.
+
+    Timing is based on millis(), so the resolution is 1ms.
+
+    Once playback finishes, Hardware::init() should be called to return the
+    OPL3 to a known state.
+*/
+
+#ifndef CANYON_OPL3REGISTERPLAYER_H
+#define CANYON_OPL3REGISTERPLAYER_H 1
+
+#include <stdint.h>
+#include "OPL3Hardware.h"
+#include "OPL3RegisterLog.h"
+
+#define REGISTER_PLAYER_QUEUE_SIZE  32
+
+namespace OPL3 {
+
+typedef enum {
+    DROFormat       = 0,
+    VGMFormat       = 1,
+    IMFFormat       = 2,    // 560Hz (most games)
+    IMF700Format    = 3     // 700Hz (Wolfenstein 3D)
+} RegisterLogFormat;
+
+class RegisterPlayer {
+    public:
+        RegisterPlayer(
+            Hardware &opl3);
+
+        void begin(
+            RegisterLogFormat format);
+
+        // Returns false if the byte cannot be accepted yet (in which case
+        // service() needs to be called to make space)
+        bool put(
+            uint8_t data);
+
+        // Signals that there is no more data
+        void end();
+
+        void service();
+
+        // Playback continues until all of the data has been played
+        bool isPlaying() const;
+
+    private:
+        void putDRO(
+            uint8_t data);
+
+        void putVGM(
+            uint8_t data);
+
+        void putIMF(
+            uint8_t data);
+
+        void addDelay(
+            uint32_t ticks);
+
+        uint32_t getTimelineMillis() const;
+
+        void queueWrite(
+            bool primaryRegisterSet,
+            uint8_t reg,
+            uint8_t data);
+
+        // Queues delay-only entries until what's left of the delay up to the
+        // timeline fits in one entry, leaving reserve entries free. Returns
+        // false if it ran out of space first.
+        bool queueLongDelays(
+            uint8_t reserve);
+
+        void queue(
+            const RegisterWrite &write);
+
+        Hardware &m_opl3;
+
+        RegisterLogFormat m_format;
+
+        unsigned m_playing          : 1;
+        unsigned m_inputEnded       : 1;
+        unsigned m_hasLength        : 1;    // m_remaining is valid
+
+        // Position in the input, and the current record within it
+        uint32_t m_position;
+        uint8_t m_record[8];
+        uint8_t m_recordLength;
+        uint8_t m_recordPosition;
+
+        // Bytes to ignore before decoding resumes
+        uint32_t m_skip;
+
+        // Records remaining, if known
+        uint32_t m_remaining;
+
+        // Format-specific header values
+        uint32_t m_dataOffset;
+        uint8_t m_shortDelayCode;
+        uint8_t m_longDelayCode;
+        uint8_t m_codemapLength;
+        uint8_t m_codemap[128];
+
+        // The input timeline, in ticks of the format's rate
+        uint16_t m_tickRate;
+        uint16_t m_ticks;
+        uint32_t m_seconds;
+        uint32_t m_queuedMillis;
+
+        RegisterWrite m_queue[REGISTER_PLAYER_QUEUE_SIZE];
+        uint8_t m_readIndex;
+        uint8_t m_writeIndex;
+        uint8_t m_usage;
+
+        unsigned long m_scheduledMillis;
+};
+
+}
+
+#endif
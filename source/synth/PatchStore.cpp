@@ -0,0 +1,71 @@
+/*
+    Project:    Canyon
+    Purpose:    User patch storage in EEPROM
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+*/
+
+#include "PatchStore.h"
+#include "OPL3Hardware.h"
+
+#ifdef ARDUINO
+    #include <avr/eeprom.h>
+#else
+    #include <string.h>
+
+    static uint8_t eeprom[USER_PATCH_SLOTS * sizeof(UserPatch)];
+    static bool eepromErased = false;
+#endif
+
+static_assert(sizeof(UserPatch) == 26, "UserPatch size has changed");
+
+static uint8_t *getSlotAddress(
+    uint8_t slot)
+{
+#ifdef ARDUINO
+    return (uint8_t *)(USER_PATCH_ADDRESS + slot * sizeof(UserPatch));
+#else
+    if (!eepromErased) {
+        memset(eeprom, 0xff, sizeof(eeprom));
+        eepromErased = true;
+    }
+
+    return eeprom + slot * sizeof(UserPatch);
+#endif
+}
+
+bool readUserPatch(
+    uint8_t slot,
+    UserPatch &patch)
+{
+    if (slot >= USER_PATCH_SLOTS) {
+        return false;
+    }
+
+#ifdef ARDUINO
+    eeprom_read_block(&patch, getSlotAddress(slot), sizeof(patch));
+#else
+    memcpy(&patch, getSlotAddress(slot), sizeof(patch));
+#endif
+
+    return (patch.type == OPL3::Melody2OpChannelType)
+        || (patch.type == OPL3::Melody4OpChannelType);
+}
+
+bool writeUserPatch(
+    uint8_t slot,
+    const UserPatch &patch)
+{
+    if (slot >= USER_PATCH_SLOTS) {
+        return false;
+    }
+
+#ifdef ARDUINO
+    eeprom_update_block(&patch, getSlotAddress(slot), sizeof(patch));
+#else
+    memcpy(getSlotAddress(slot), &patch, sizeof(patch));
+#endif
+
+    return true;
+}
@@ -0,0 +1,48 @@
+/*
+    Project:    Canyon
+    Purpose:    User patch storage in EEPROM
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    Each slot holds a patch laid out the same way as MIDIControl's channel
+    data (and the bank), so it can be copied in and out with a single block
+    read or write. The 16 slots use 416 of the ATmega328's 1024 bytes.
+
+    Erased EEPROM reads as 0xff, which is not a valid channel type, so slots
+    which have never been saved to are treated as empty.
+
+    On the host the EEPROM is simulated and starts off erased.
+*/
+
+#ifndef CANYON_PATCHSTORE_H
+#define CANYON_PATCHSTORE_H 1
+
+#include <stdint.h>
+#include "bank.h"
+
+#define USER_PATCH_SLOTS    16
+
+// Start of the slots in EEPROM
+#define USER_PATCH_ADDRESS  0
+
+typedef struct __attribute__((packed)) UserPatch {
+    uint8_t type;                       // OPL3::ChannelType
+    unsigned feedbackModulationFactor   : 3;
+    unsigned synthType                  : 2;
+    unsigned                            : 3;
+    OperatorPatch operators[4];         // Only the first 2 for 2-op patches
+} UserPatch;
+
+// Returns false if the slot is out of range or empty
+bool readUserPatch(
+    uint8_t slot,
+    UserPatch &patch);
+
+// Returns false if the slot is out of range. Only bytes which have changed
+// are written, as EEPROM cells wear out.
+bool writeUserPatch(
+    uint8_t slot,
+    const UserPatch &patch);
+
+#endif
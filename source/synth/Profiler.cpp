@@ -0,0 +1,130 @@
+/*
+    Project:    Canyon
+    Purpose:    Function profiling
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+*/
+
+#ifdef ARDUINO
+    #include <arduino.h>
+#endif
+
+#include "Profiler.h"
+
+typedef struct ProfileEntry {
+    uint32_t calls;
+    uint32_t totalTicks;
+    uint16_t maxTicks;
+} ProfileEntry;
+
+#ifdef ARDUINO
+static ProfileEntry profileEntries[NumberOfProfilePoints];
+#else
+// Each rendering thread has its own simulated clock (see prototype/Timing.h)
+static thread_local ProfileEntry profileEntries[NumberOfProfilePoints];
+#endif
+
+void initProfiler()
+{
+#ifdef ARDUINO
+    // Normal mode (free-running), clock / 8, no interrupts
+    TCCR1A = 0;
+    TCCR1B = _BV(CS11);
+    TCCR1C = 0;
+    TIMSK1 = 0;
+    TCNT1 = 0;
+#endif
+
+    clearProfiler();
+}
+
+void clearProfiler()
+{
+    for (uint8_t i = 0; i < NumberOfProfilePoints; ++ i) {
+        profileEntries[i].calls = 0;
+        profileEntries[i].totalTicks = 0;
+        profileEntries[i].maxTicks = 0;
+    }
+}
+
+void recordProfile(
+    ProfilePoint point,
+    uint16_t ticks)
+{
+    ProfileEntry &entry = profileEntries[point];
+
+    ++ entry.calls;
+    entry.totalTicks += ticks;
+
+    if (ticks > entry.maxTicks) {
+        entry.maxTicks = ticks;
+    }
+}
+
+uint32_t getProfileCallCount(
+    ProfilePoint point)
+{
+    return profileEntries[point].calls;
+}
+
+uint32_t getProfileTotalCycles(
+    ProfilePoint point)
+{
+    return profileEntries[point].totalTicks * PROFILER_PRESCALER;
+}
+
+uint32_t getProfileMaxCycles(
+    ProfilePoint point)
+{
+    return (uint32_t)profileEntries[point].maxTicks * PROFILER_PRESCALER;
+}
+
+#ifdef ARDUINO
+void dumpProfile(
+    Print &output)
+{
+    output.println(F("Function\tcalls\ttotal\tmax\t(cycles)"));
+
+    for (uint8_t i = 0; i < NumberOfProfilePoints; ++ i) {
+        switch (i) {
+            case ProfilePlayNote:
+                output.print(F("playNote"));
+                break;
+
+            case ProfileStopNote:
+                output.print(F("stopNote"));
+                break;
+
+            case ProfileSetController:
+                output.print(F("setController"));
+                break;
+
+            case ProfileService:
+                output.print(F("service"));
+                break;
+
+            case ProfileUpdateAttenuation:
+                output.print(F("updateAttenuation"));
+                break;
+
+            case ProfileSetFrequency:
+                output.print(F("setFrequency"));
+                break;
+
+            case ProfileISABusWrite:
+                output.print(F("ISABus::write"));
+                break;
+        };
+
+        output.print('\t');
+        output.print(getProfileCallCount((ProfilePoint)i));
+        output.print('\t');
+        output.print(getProfileTotalCycles((ProfilePoint)i));
+        output.print('\t');
+        output.println(getProfileMaxCycles((ProfilePoint)i));
+    }
+
+    clearProfiler();
+}
+#endif
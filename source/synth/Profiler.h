@@ -0,0 +1,116 @@
+/*
+    Project:    Canyon
+    Purpose:    Function profiling
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    Counts calls and accumulates the total and maximum time taken by a few
+    hot functions, by placing PROFILE_SCOPE at the top of each one. Times are
+    inclusive (e.g. playNote includes the ISA bus writes it makes).
+
+    On the Arduino, Timer1 is used as a free-running counter with a prescaler
+    of 8, so times are measured in units of 8 CPU cycles and anything longer
+    than about 32ms will wrap around. This means Timer1 is not available for
+    PWM (pins 9 and 10) while profiling is enabled.
+
+    On the host, the simulated clock is used instead (see prototype/Timing.h).
+
+    The totals are kept in 32 bits, so should be dumped at least every few
+    minutes of busy time to avoid them wrapping.
+
+    Profiling is only compiled in when WITH_PROFILER is defined below, since
+    it affects every function it measures.
+*/
+
+#ifndef CANYON_PROFILER_H
+#define CANYON_PROFILER_H 1
+
+// Define this to enable profiling, which can be retrieved by sending a
+// SysExDumpProfile request
+//#define WITH_PROFILER
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+    #include <avr/io.h>
+    class Print;
+#else
+    #include "prototype/Timing.h"
+#endif
+
+// CPU cycles per profiler tick
+#define PROFILER_PRESCALER  8
+
+typedef enum {
+    ProfilePlayNote             = 0,
+    ProfileStopNote             = 1,
+    ProfileSetController        = 2,
+    ProfileService              = 3,
+    ProfileUpdateAttenuation    = 4,
+    ProfileSetFrequency         = 5,
+    ProfileISABusWrite          = 6,
+
+    NumberOfProfilePoints
+} ProfilePoint;
+
+inline uint16_t getProfilerTicks()
+{
+#ifdef ARDUINO
+    return TCNT1;
+#else
+    // Ticks are 0.5us at 16MHz
+    return (uint16_t)(micros() * 2);
+#endif
+}
+
+// Starts Timer1 and clears the results
+void initProfiler();
+
+void clearProfiler();
+
+void recordProfile(
+    ProfilePoint point,
+    uint16_t ticks);
+
+uint32_t getProfileCallCount(
+    ProfilePoint point);
+
+// In CPU cycles
+uint32_t getProfileTotalCycles(
+    ProfilePoint point);
+
+uint32_t getProfileMaxCycles(
+    ProfilePoint point);
+
+#ifdef ARDUINO
+// Outputs the results as text, then clears them
+void dumpProfile(
+    Print &output);
+#endif
+
+class ProfileScope {
+    public:
+        ProfileScope(
+            ProfilePoint point)
+        : m_point(point), m_startTicks(getProfilerTicks())
+        {
+        }
+
+        ~ProfileScope()
+        {
+            recordProfile(m_point, getProfilerTicks() - m_startTicks);
+        }
+
+    private:
+        ProfilePoint m_point;
+        uint16_t m_startTicks;
+};
+
+#ifdef WITH_PROFILER
+    #define PROFILE_SCOPE(point)    ProfileScope profileScope(point)
+#else
+    #define PROFILE_SCOPE(point)
+#endif
+
+#endif
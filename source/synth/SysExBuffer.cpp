@@ -0,0 +1,93 @@
+/*
+    Project:    Canyon
+    Purpose:    MIDI System Exclusive message buffering
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+*/
+
+#include "SysExBuffer.h"
+
+SysExBuffer::SysExBuffer()
+: m_length(0), m_receiving(false), m_complete(false), m_overflowed(false),
+  m_streaming(false)
+{
+}
+
+bool SysExBuffer::receive(
+    uint8_t data)
+{
+    if (data == 0xf0) {
+        // Any unprocessed message is discarded
+        clear();
+        m_receiving = true;
+        return true;
+    }
+
+    if (!m_receiving) {
+        return false;
+    }
+
+    if (data >= 0xf8) {
+        // Real-time messages can appear anywhere
+        return false;
+    }
+
+    if (data == 0xf7) {
+        m_receiving = false;
+        m_complete = !m_overflowed;
+        return true;
+    }
+
+    if (data & 0x80) {
+        // Any other status byte aborts the message
+        clear();
+        return false;
+    }
+
+    if (m_streaming) {
+        return true;
+    }
+
+    if (m_length == SYSEX_BUFFER_SIZE) {
+        m_overflowed = true;
+    } else {
+        m_buffer[m_length ++] = data;
+    }
+
+    return true;
+}
+
+bool SysExBuffer::isComplete() const
+{
+    return m_complete;
+}
+
+void SysExBuffer::stream()
+{
+    m_streaming = true;
+}
+
+bool SysExBuffer::isStreaming() const
+{
+    return m_streaming;
+}
+
+const uint8_t *SysExBuffer::getData() const
+{
+    return m_buffer;
+}
+
+uint8_t SysExBuffer::getLength() const
+{
+    return m_length;
+}
+
+void SysExBuffer::clear()
+{
+    m_length = 0;
+    m_receiving = false;
+    m_complete = false;
+    m_overflowed = false;
+    m_streaming = false;
+}
@@ -0,0 +1,82 @@
+/*
+    Project:    Canyon
+    Purpose:    MIDI System Exclusive message buffering
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    Canyon SysEx messages use the non-commercial manufacturer ID:
+
+        F0 7D <command> [<data> ...] F7
+
+    The buffered message excludes the F0 and F7 bytes.
+
+    Store and recall requests are answered with the same command and whether
+    they succeeded (1) or not (0):
+
+        F0 7D <command> <result> F7
+
+    Messages too long to buffer can be streamed: once the start of the message
+    has been buffered, stream() stops the rest being buffered so it can be
+    handled a byte at a time as it arrives.
+*/
+
+#ifndef CANYON_SYSEXBUFFER_H
+#define CANYON_SYSEXBUFFER_H 1
+
+#include <stdint.h>
+
+#define SYSEX_BUFFER_SIZE       16
+#define SYSEX_MANUFACTURER_ID   0x7d
+
+typedef enum {
+    SysExDumpRegisterLog    = 0x01,
+    SysExPlayRegisterLog    = 0x02,     // <format> (see OPL3RegisterPlayer.h)
+    SysExDumpLatency        = 0x03,
+    SysExDumpProfile        = 0x04,
+    SysExDumpMemoryUsage    = 0x05,
+    SysExStorePatch         = 0x06,     // <MIDI channel> <slot> (see PatchStore.h)
+    SysExRecallPatch        = 0x07,     // <MIDI channel> <slot>
+    SysExDumpPatch          = 0x08,     // <MIDI channel> (see SysExPatch.h)
+    SysExLoadPatch          = 0x09,     // <MIDI channel> <patch> (streamed)
+    SysExDumpSetup          = 0x0a,
+    SysExLoadSetup          = 0x0b,     // <patch> x 16 (streamed)
+    SysExSetZone            = 0x0c,     // <zone> <input channel> <target channel> <low note>
+                                        // <high note> <low velocity> <high velocity>
+                                        // <program> <transpose + 64>
+    SysExClearZone          = 0x0d      // <zone>
+} SysExCommand;
+
+class SysExBuffer {
+    public:
+        SysExBuffer();
+
+        // Returns true if the byte is part of a SysEx message (in which case
+        // it should not be treated as regular MIDI data)
+        bool receive(
+            uint8_t data);
+
+        bool isComplete() const;
+
+        // Data bytes after this are accepted but not buffered
+        void stream();
+
+        bool isStreaming() const;
+
+        const uint8_t *getData() const;
+
+        uint8_t getLength() const;
+
+        void clear();
+
+    private:
+        uint8_t m_buffer[SYSEX_BUFFER_SIZE];
+        uint8_t m_length;
+
+        unsigned m_receiving    : 1;
+        unsigned m_complete     : 1;
+        unsigned m_overflowed   : 1;
+        unsigned m_streaming    : 1;
+};
+
+#endif
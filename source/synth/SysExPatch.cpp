@@ -0,0 +1,104 @@
+/*
+    Project:    Canyon
+    Purpose:    SysEx patch dumps and loads
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+*/
+
+#include "SysExPatch.h"
+
+static_assert(sizeof(ChannelPatch) == 28, "SysEx patch format has changed");
+static_assert((sizeof(ChannelPatch) / 7) * 8 + 1 == SYSEX_PATCH_LENGTH,
+              "SYSEX_PATCH_LENGTH is wrong");
+
+void packPatch(
+    const ChannelPatch &patch,
+    uint8_t *data)
+{
+    const uint8_t *bytes = (const uint8_t *)&patch;
+    uint8_t *topBits = data;
+    uint8_t length = 0;
+    uint8_t checksum = 0;
+
+    for (uint8_t i = 0; i < sizeof(patch); ++ i) {
+        if (i % 7 == 0) {
+            topBits = &data[length ++];
+            *topBits = 0;
+        }
+
+        *topBits |= (bytes[i] >> 7) << (i % 7);
+        data[length ++] = bytes[i] & 0x7f;
+    }
+
+    for (uint8_t i = 0; i < length; ++ i) {
+        checksum += data[i];
+    }
+
+    data[length] = (0x80 - (checksum & 0x7f)) & 0x7f;
+}
+
+SysExPatchLoader::SysExPatchLoader(
+    MIDIControl &midiControl)
+: m_midiControl(midiControl),
+  m_channel(0),
+  m_remainingChannels(0),
+  m_loadedCount(0),
+  m_position(0),
+  m_topBits(0),
+  m_checksum(0)
+{
+}
+
+void SysExPatchLoader::begin(
+    uint8_t firstChannel,
+    uint8_t numberOfChannels)
+{
+    m_channel = firstChannel;
+    m_remainingChannels = numberOfChannels;
+    m_loadedCount = 0;
+    m_position = 0;
+    m_checksum = 0;
+}
+
+void SysExPatchLoader::put(
+    uint8_t data)
+{
+    if (m_remainingChannels == 0) {
+        return;
+    }
+
+    m_checksum += data;
+
+    if (m_position == SYSEX_PATCH_LENGTH - 1) {
+        // Checksum - a bad patch is skipped
+        if ((m_checksum & 0x7f) == 0) {
+            if (m_midiControl.setChannelPatch(m_channel, m_patch)) {
+                ++ m_loadedCount;
+            }
+        }
+
+        ++ m_channel;
+        -- m_remainingChannels;
+        m_position = 0;
+        m_checksum = 0;
+        return;
+    }
+
+    uint8_t group = m_position / 8;
+    uint8_t index = m_position % 8;
+
+    if (index == 0) {
+        m_topBits = data;
+    } else {
+        -- index;
+        ((uint8_t *)&m_patch)[group * 7 + index] = data | (((m_topBits >> index) & 0x1) << 7);
+    }
+
+    ++ m_position;
+}
+
+uint8_t SysExPatchLoader::getLoadedCount() const
+{
+    return m_loadedCount;
+}
@@ -0,0 +1,67 @@
+/*
+    Project:    Canyon
+    Purpose:    SysEx patch dumps and loads
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    A channel's patch (see ChannelPatch in MIDIControl.h) is 28 bytes, sent
+    as 32 SysEx data bytes: each group of 7 bytes is preceded by a byte
+    holding their top bits (bit 0 for the first byte in the group). This is
+    followed by a checksum which makes the sum of all 33 bytes a multiple of
+    128.
+
+        F0 7D 08 <channel> F7                   Request a patch dump
+        F0 7D 09 <channel> <patch> F7           Patch dump, or load
+        F0 7D 0A F7                             Request a setup dump
+        F0 7D 0B <patch> (x 16) F7              Setup dump, or load
+
+    A setup is the patch for each of the 16 MIDI channels, which is much too
+    big for the SysEx buffer, so loads are decoded as they arrive. Each
+    channel's patch is applied once all of it has arrived and the checksum
+    matches, so notes never play with half of a patch.
+*/
+
+#ifndef CANYON_SYSEXPATCH_H
+#define CANYON_SYSEXPATCH_H 1
+
+#include <stdint.h>
+#include "MIDIControl.h"
+
+#define SYSEX_PATCH_LENGTH  33
+
+// Fills data with SYSEX_PATCH_LENGTH bytes
+void packPatch(
+    const ChannelPatch &patch,
+    uint8_t *data);
+
+class SysExPatchLoader {
+    public:
+        SysExPatchLoader(MIDIControl &midiControl);
+
+        // Expects patches for the given number of MIDI channels, starting
+        // from firstChannel
+        void begin(
+            uint8_t firstChannel,
+            uint8_t numberOfChannels);
+
+        // Takes the next SysEx data byte
+        void put(
+            uint8_t data);
+
+        // Patches applied since begin()
+        uint8_t getLoadedCount() const;
+
+    private:
+        MIDIControl &m_midiControl;
+
+        ChannelPatch m_patch;
+        uint8_t m_channel;
+        uint8_t m_remainingChannels;
+        uint8_t m_loadedCount;
+        uint8_t m_position;     // In the SysEx data for the current patch
+        uint8_t m_topBits;
+        uint8_t m_checksum;
+};
+
+#endif
@@ -0,0 +1,350 @@
+#include "bank.h"
+
+#ifdef ARDUINO
+    #include <avr/pgmspace.h>
+#else
+    #include <string.h>
+    #define PROGMEM
+#endif
+
+static_assert(sizeof(OperatorPatch) == 6, "OperatorPatch must match the bank");
+static_assert(sizeof(BankPatch) == 6, "BankPatch must match the bank");
+static_assert(sizeof(BankDrum) == 2, "BankDrum must match the bank");
+
+// Registers 0x20, 0x40 (level), 0x60, 0x80, 0xe0 and velocity-to-level
+const PROGMEM static uint8_t bankOperators[47][6] = {
+    {0x01, 0x61, 0xf3, 0x53, 0x00, 0x10}, // 0: Piano
+    {0x01, 0x3f, 0xf2, 0x64, 0x00, 0x28}, // 1: Piano
+    {0x07, 0x1b, 0xf5, 0x85, 0x00, 0x10}, // 2: Chromatic Percussion
+    {0x01, 0x3f, 0xf4, 0x75, 0x00, 0x28}, // 3: Chromatic Percussion
+    {0x22, 0x37, 0xf0, 0x07, 0x00, 0x18}, // 4: Organ
+    {0x21, 0x3f, 0xf0, 0x07, 0x00, 0x18}, // 5: Organ
+    {0x01, 0x23, 0xf4, 0x64, 0x01, 0x10}, // 6: Guitar
+    {0x01, 0x3f, 0xf3, 0x75, 0x00, 0x28}, // 7: Guitar
+    {0x00, 0x27, 0xf5, 0x56, 0x00, 0x10}, // 8: Bass
+    {0x21, 0x3f, 0xf3, 0x46, 0x00, 0x28}, // 9: Bass
+    {0x61, 0x25, 0x71, 0x26, 0x00, 0x10}, // 10: Strings
+    {0x61, 0x3f, 0x61, 0x16, 0x00, 0x20}, // 11: Strings
+    {0x22, 0x1d, 0x62, 0x35, 0x00, 0x10}, // 12: Ensemble
+    {0x61, 0x3f, 0x61, 0x25, 0x00, 0x20}, // 13: Ensemble
+    {0x21, 0x29, 0xb2, 0x27, 0x00, 0x18}, // 14: Brass
+    {0x21, 0x3f, 0xa1, 0x17, 0x00, 0x28}, // 15: Brass
+    {0x22, 0x25, 0xb2, 0x37, 0x00, 0x18}, // 16: Reed
+    {0x21, 0x3f, 0xb1, 0x27, 0x00, 0x28}, // 17: Reed
+    {0x22, 0x17, 0x92, 0x27, 0x00, 0x10}, // 18: Pipe
+    {0x61, 0x3f, 0x91, 0x17, 0x00, 0x20}, // 19: Pipe
+    {0x21, 0x2b, 0xf0, 0x07, 0x02, 0x10}, // 20: Synth Lead
+    {0x21, 0x3f, 0xf0, 0x07, 0x01, 0x20}, // 21: Synth Lead
+    {0x61, 0x21, 0x42, 0x24, 0x00, 0x10}, // 22: Synth Pad
+    {0x61, 0x3f, 0x41, 0x14, 0x00, 0x20}, // 23: Synth Pad
+    {0xa3, 0x23, 0x53, 0x44, 0x00, 0x10}, // 24: Synth Effects
+    {0x21, 0x3f, 0x52, 0x34, 0x00, 0x20}, // 25: Synth Effects
+    {0x03, 0x21, 0xf5, 0x75, 0x00, 0x10}, // 26: Ethnic
+    {0x01, 0x3f, 0xf4, 0x85, 0x00, 0x28}, // 27: Ethnic
+    {0x02, 0x25, 0xf6, 0xa6, 0x00, 0x10}, // 28: Percussive
+    {0x01, 0x3f, 0xf5, 0x96, 0x00, 0x28}, // 29: Percussive
+    {0x2f, 0x2b, 0xd4, 0x53, 0x00, 0x10}, // 30: Sound Effects
+    {0x21, 0x3f, 0xc3, 0x43, 0x00, 0x20}, // 31: Sound Effects
+    {0x00, 0x2b, 0xf8, 0xf8, 0x00, 0x10}, // 32: Kick
+    {0x00, 0x3f, 0xf7, 0xf8, 0x00, 0x30}, // 33: Kick
+    {0x05, 0x21, 0xf7, 0xf7, 0x00, 0x10}, // 34: Wood Block
+    {0x01, 0x3f, 0xf6, 0xf7, 0x00, 0x30}, // 35: Wood Block
+    {0x0f, 0x3f, 0xf7, 0xf7, 0x00, 0x10}, // 36: Snare
+    {0x0f, 0x3f, 0xf8, 0xf8, 0x00, 0x10}, // 37: Clap
+    {0x02, 0x3f, 0xf8, 0xf8, 0x00, 0x30}, // 38: Clap
+    {0x01, 0x21, 0xf6, 0xf6, 0x00, 0x10}, // 39: Tom
+    {0x01, 0x3f, 0xf5, 0xf6, 0x00, 0x30}, // 40: Tom
+    {0x0f, 0x3f, 0xf9, 0xf9, 0x00, 0x10}, // 41: Closed Hi-Hat
+    {0x0d, 0x3f, 0xf9, 0xf9, 0x00, 0x30}, // 42: Closed Hi-Hat
+    {0x0f, 0x3f, 0xf5, 0xf5, 0x00, 0x10}, // 43: Open Hi-Hat
+    {0x0d, 0x3f, 0xf5, 0xf5, 0x00, 0x30}, // 44: Open Hi-Hat
+    {0x0f, 0x3f, 0xf3, 0xf3, 0x00, 0x10}, // 45: Cymbal
+    {0x0b, 0x3f, 0xf3, 0xf3, 0x00, 0x30} // 46: Cymbal
+};
+
+// Channel type | (bit 8 of each operator << 3), feedback | (synth type << 3),
+// low 8 bits of each operator
+const PROGMEM static uint8_t bankPatches[24][6] = {
+    {1, 3, 0, 1, 0, 0}, // 0: Piano
+    {1, 2, 2, 3, 0, 0}, // 1: Chromatic Percussion
+    {1, 8, 4, 5, 0, 0}, // 2: Organ
+    {1, 4, 6, 7, 0, 0}, // 3: Guitar
+    {1, 5, 8, 9, 0, 0}, // 4: Bass
+    {1, 3, 10, 11, 0, 0}, // 5: Strings
+    {1, 2, 12, 13, 0, 0}, // 6: Ensemble
+    {1, 5, 14, 15, 0, 0}, // 7: Brass
+    {1, 6, 16, 17, 0, 0}, // 8: Reed
+    {1, 1, 18, 19, 0, 0}, // 9: Pipe
+    {1, 6, 20, 21, 0, 0}, // 10: Synth Lead
+    {1, 3, 22, 23, 0, 0}, // 11: Synth Pad
+    {1, 7, 24, 25, 0, 0}, // 12: Synth Effects
+    {1, 4, 26, 27, 0, 0}, // 13: Ethnic
+    {1, 3, 28, 29, 0, 0}, // 14: Percussive
+    {1, 7, 30, 31, 0, 0}, // 15: Sound Effects
+    {1, 5, 32, 33, 0, 0}, // 16: Kick
+    {1, 2, 34, 35, 0, 0}, // 17: Wood Block
+    {1, 7, 36, 35, 0, 0}, // 18: Snare
+    {1, 7, 37, 38, 0, 0}, // 19: Clap
+    {1, 3, 39, 40, 0, 0}, // 20: Tom
+    {1, 7, 41, 42, 0, 0}, // 21: Closed Hi-Hat
+    {1, 7, 43, 44, 0, 0}, // 22: Open Hi-Hat
+    {1, 7, 45, 46, 0, 0} // 23: Cymbal
+};
+
+// Patch for each program
+const PROGMEM static uint8_t programPatches[BANK_PROGRAMS] = {
+    0, // 0: Piano
+    0, // 1: Piano
+    0, // 2: Piano
+    0, // 3: Piano
+    0, // 4: Piano
+    0, // 5: Piano
+    0, // 6: Piano
+    0, // 7: Piano
+    1, // 8: Chromatic Percussion
+    1, // 9: Chromatic Percussion
+    1, // 10: Chromatic Percussion
+    1, // 11: Chromatic Percussion
+    1, // 12: Chromatic Percussion
+    1, // 13: Chromatic Percussion
+    1, // 14: Chromatic Percussion
+    1, // 15: Chromatic Percussion
+    2, // 16: Organ
+    2, // 17: Organ
+    2, // 18: Organ
+    2, // 19: Organ
+    2, // 20: Organ
+    2, // 21: Organ
+    2, // 22: Organ
+    2, // 23: Organ
+    3, // 24: Guitar
+    3, // 25: Guitar
+    3, // 26: Guitar
+    3, // 27: Guitar
+    3, // 28: Guitar
+    3, // 29: Guitar
+    3, // 30: Guitar
+    3, // 31: Guitar
+    4, // 32: Bass
+    4, // 33: Bass
+    4, // 34: Bass
+    4, // 35: Bass
+    4, // 36: Bass
+    4, // 37: Bass
+    4, // 38: Bass
+    4, // 39: Bass
+    5, // 40: Strings
+    5, // 41: Strings
+    5, // 42: Strings
+    5, // 43: Strings
+    5, // 44: Strings
+    5, // 45: Strings
+    5, // 46: Strings
+    5, // 47: Strings
+    6, // 48: Ensemble
+    6, // 49: Ensemble
+    6, // 50: Ensemble
+    6, // 51: Ensemble
+    6, // 52: Ensemble
+    6, // 53: Ensemble
+    6, // 54: Ensemble
+    6, // 55: Ensemble
+    7, // 56: Brass
+    7, // 57: Brass
+    7, // 58: Brass
+    7, // 59: Brass
+    7, // 60: Brass
+    7, // 61: Brass
+    7, // 62: Brass
+    7, // 63: Brass
+    8, // 64: Reed
+    8, // 65: Reed
+    8, // 66: Reed
+    8, // 67: Reed
+    8, // 68: Reed
+    8, // 69: Reed
+    8, // 70: Reed
+    8, // 71: Reed
+    9, // 72: Pipe
+    9, // 73: Pipe
+    9, // 74: Pipe
+    9, // 75: Pipe
+    9, // 76: Pipe
+    9, // 77: Pipe
+    9, // 78: Pipe
+    9, // 79: Pipe
+    10, // 80: Synth Lead
+    10, // 81: Synth Lead
+    10, // 82: Synth Lead
+    10, // 83: Synth Lead
+    10, // 84: Synth Lead
+    10, // 85: Synth Lead
+    10, // 86: Synth Lead
+    10, // 87: Synth Lead
+    11, // 88: Synth Pad
+    11, // 89: Synth Pad
+    11, // 90: Synth Pad
+    11, // 91: Synth Pad
+    11, // 92: Synth Pad
+    11, // 93: Synth Pad
+    11, // 94: Synth Pad
+    11, // 95: Synth Pad
+    12, // 96: Synth Effects
+    12, // 97: Synth Effects
+    12, // 98: Synth Effects
+    12, // 99: Synth Effects
+    12, // 100: Synth Effects
+    12, // 101: Synth Effects
+    12, // 102: Synth Effects
+    12, // 103: Synth Effects
+    13, // 104: Ethnic
+    13, // 105: Ethnic
+    13, // 106: Ethnic
+    13, // 107: Ethnic
+    13, // 108: Ethnic
+    13, // 109: Ethnic
+    13, // 110: Ethnic
+    13, // 111: Ethnic
+    14, // 112: Percussive
+    14, // 113: Percussive
+    14, // 114: Percussive
+    14, // 115: Percussive
+    14, // 116: Percussive
+    14, // 117: Percussive
+    14, // 118: Percussive
+    14, // 119: Percussive
+    15, // 120: Sound Effects
+    15, // 121: Sound Effects
+    15, // 122: Sound Effects
+    15, // 123: Sound Effects
+    15, // 124: Sound Effects
+    15, // 125: Sound Effects
+    15, // 126: Sound Effects
+    15 // 127: Sound Effects
+};
+
+// Patch, note to play and voice | (choke group << 3) for each percussion note
+const PROGMEM static uint8_t percussionPatches[BANK_LAST_PERCUSSION_NOTE - BANK_FIRST_PERCUSSION_NOTE + 1][3] = {
+    {16, 22, 3}, // 35: Acoustic Bass Drum
+    {16, 24, 3}, // 36: Bass Drum 1
+    {17, 72, 1}, // 37: Side Stick
+    {18, 60, 4}, // 38: Acoustic Snare
+    {19, 64, 1}, // 39: Hand Clap
+    {18, 62, 4}, // 40: Electric Snare
+    {20, 41, 5}, // 41: Low Floor Tom
+    {21, 84, 15}, // 42: Closed Hi-Hat
+    {20, 43, 5}, // 43: High Floor Tom
+    {21, 80, 15}, // 44: Pedal Hi-Hat
+    {20, 45, 5}, // 45: Low Tom
+    {22, 84, 15}, // 46: Open Hi-Hat
+    {20, 47, 5}, // 47: Low-Mid Tom
+    {20, 50, 5}, // 48: Hi-Mid Tom
+    {23, 80, 6}, // 49: Crash Cymbal 1
+    {20, 53, 5}, // 50: High Tom
+    {23, 88, 6}, // 51: Ride Cymbal 1
+    {23, 76, 6}, // 52: Chinese Cymbal
+    {17, 84, 1}, // 53: Ride Bell
+    {21, 90, 1}, // 54: Tambourine
+    {23, 86, 6}, // 55: Splash Cymbal
+    {17, 68, 1}, // 56: Cowbell
+    {23, 78, 6}, // 57: Crash Cymbal 2
+    {22, 70, 1}, // 58: Vibraslap
+    {23, 86, 6}, // 59: Ride Cymbal 2
+    {20, 64, 1}, // 60: Hi Bongo
+    {20, 60, 1}, // 61: Low Bongo
+    {20, 62, 1}, // 62: Mute Hi Conga
+    {20, 60, 1}, // 63: Open Hi Conga
+    {20, 55, 1}, // 64: Low Conga
+    {20, 67, 1}, // 65: High Timbale
+    {20, 62, 1}, // 66: Low Timbale
+    {17, 84, 1}, // 67: High Agogo
+    {17, 79, 1}, // 68: Low Agogo
+    {21, 96, 1}, // 69: Cabasa
+    {21, 100, 1}, // 70: Maracas
+    {17, 96, 17}, // 71: Short Whistle
+    {17, 91, 17}, // 72: Long Whistle
+    {21, 72, 25}, // 73: Short Guiro
+    {22, 72, 25}, // 74: Long Guiro
+    {17, 84, 1}, // 75: Claves
+    {17, 79, 1}, // 76: Hi Wood Block
+    {17, 74, 1}, // 77: Low Wood Block
+    {20, 72, 33}, // 78: Mute Cuica
+    {20, 67, 33}, // 79: Open Cuica
+    {17, 96, 41}, // 80: Mute Triangle
+    {17, 96, 41} // 81: Open Triangle
+};
+
+static void getPatch(
+    uint8_t index,
+    BankPatch &patch)
+{
+#ifdef ARDUINO
+    memcpy_P(&patch, bankPatches[index], sizeof(patch));
+#else
+    memcpy(&patch, bankPatches[index], sizeof(patch));
+#endif
+}
+
+bool getProgramPatch(
+    uint8_t program,
+    BankPatch &patch)
+{
+    if (program >= BANK_PROGRAMS)
+        return false;
+
+#ifdef ARDUINO
+    getPatch(pgm_read_byte_near(programPatches + program), patch);
+#else
+    getPatch(programPatches[program], patch);
+#endif
+
+    return true;
+}
+
+bool getPercussionDrum(
+    uint8_t note,
+    BankDrum &drum)
+{
+    if ((note < BANK_FIRST_PERCUSSION_NOTE) || (note > BANK_LAST_PERCUSSION_NOTE))
+        return false;
+
+    note -= BANK_FIRST_PERCUSSION_NOTE;
+
+#ifdef ARDUINO
+    memcpy_P(&drum, &percussionPatches[note][1], sizeof(drum));
+#else
+    memcpy(&drum, &percussionPatches[note][1], sizeof(drum));
+#endif
+
+    return true;
+}
+
+bool getPercussionPatch(
+    uint8_t note,
+    BankPatch &patch,
+    BankDrum &drum)
+{
+    if (!getPercussionDrum(note, drum))
+        return false;
+
+    note -= BANK_FIRST_PERCUSSION_NOTE;
+
+#ifdef ARDUINO
+    getPatch(pgm_read_byte_near(&percussionPatches[note][0]), patch);
+#else
+    getPatch(percussionPatches[note][0], patch);
+#endif
+
+    return true;
+}
+
+void getOperatorPatch(
+    uint16_t index,
+    OperatorPatch &operatorPatch)
+{
+#ifdef ARDUINO
+    memcpy_P(&operatorPatch, bankOperators[index], sizeof(operatorPatch));
+#else
+    memcpy(&operatorPatch, bankOperators[index], sizeof(operatorPatch));
+#endif
+}
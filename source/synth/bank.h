@@ -0,0 +1,112 @@
+/*
+    Project:    Canyon
+    Purpose:    General MIDI patch bank
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    The bank is generated by genbank.py (as bank.cpp) and kept in flash.
+
+    Operators are stored in the order of the OPL3 operator registers they
+    are written to (0x20, 0x40, 0x60, 0x80 and 0xe0) so they can be copied
+    straight into MIDIControl's channel data and uploaded with
+    OPL3::Hardware::setOperatorRegisters. The exception is the level, which
+    is stored as 63 - total level because the attenuation is calculated for
+    each note from the level, velocity and channel volume.
+
+    Patches refer to their operators by index, and programs to their patches
+    by index, so that identical operators and patches are only stored once.
+    There can be up to 512 operators and 256 patches.
+
+    Each percussion note also says whether it's played on a melodic channel
+    or one of the OPL3's rhythm mode voices, and which choke group (if any)
+    it belongs to.
+
+    genbank.py can also convert SBI, IBK, GENMIDI.OP2 and WOPL libraries.
+*/
+
+#ifndef CANYON_BANK_H
+#define CANYON_BANK_H 1
+
+#include <stdint.h>
+
+#define BANK_PROGRAMS               128
+
+// General MIDI percussion (channel 10) notes covered by the bank
+#define BANK_FIRST_PERCUSSION_NOTE  35
+#define BANK_LAST_PERCUSSION_NOTE   81
+
+typedef struct __attribute__((packed)) OperatorPatch {
+    // 0x20
+    unsigned frequencyMultiplicationFactor  : 4;
+    unsigned envelopeScaling    : 1;
+    unsigned sustain            : 1;
+    unsigned vibrato            : 1;
+    unsigned tremolo            : 1;
+
+    // 0x40
+    unsigned level              : 6;    // 63 - total level
+    unsigned keyScaleLevel      : 2;
+
+    // 0x60
+    unsigned decayRate          : 4;
+    unsigned attackRate         : 4;
+
+    // 0x80
+    unsigned releaseRate        : 4;
+    unsigned sustainLevel       : 4;
+
+    // 0xe0
+    unsigned waveform           : 3;
+    unsigned                    : 5;
+
+    unsigned velocityToLevel    : 6;    // How much velocity influences level
+    unsigned                    : 2;
+} OperatorPatch;
+
+typedef struct __attribute__((packed)) BankPatch {
+    unsigned type                       : 3;    // OPL3::ChannelType
+    unsigned operatorsHigh              : 4;    // Bit 8 of each operator
+    unsigned                            : 1;
+    unsigned feedbackModulationFactor   : 3;
+    unsigned synthType                  : 2;
+    unsigned                            : 3;
+    uint8_t operators[4];               // Only the first 2 for 2-op patches
+} BankPatch;
+
+typedef struct __attribute__((packed)) BankDrum {
+    unsigned playNote                   : 7;    // Fixed note to play
+    unsigned                            : 1;
+    unsigned voice                      : 3;    // OPL3::ChannelType
+    unsigned chokeGroup                 : 3;    // 0 for none
+    unsigned                            : 2;
+} BankDrum;
+
+inline uint16_t getPatchOperator(
+    const BankPatch &patch,
+    uint8_t op)
+{
+    return patch.operators[op] | (((patch.operatorsHigh >> op) & 0x1) << 8);
+}
+
+// Returns false if the program is out of range
+bool getProgramPatch(
+    uint8_t program,
+    BankPatch &patch);
+
+// Returns false if there's no patch for the note
+bool getPercussionPatch(
+    uint8_t note,
+    BankPatch &patch,
+    BankDrum &drum);
+
+// As above, without reading the patch
+bool getPercussionDrum(
+    uint8_t note,
+    BankDrum &drum);
+
+void getOperatorPatch(
+    uint16_t index,
+    OperatorPatch &operatorPatch);
+
+#endif
@@ -17,6 +17,28 @@
 // Define this to have serial output
 #define WITH_SERIAL
 
+// Define this to record OPL3 register writes, which can be retrieved as a
+// DOSBox DRO file by sending a SysExDumpRegisterLog request
+//#define WITH_REGISTER_LOG
+
+// Define this to allow DRO, VGM or IMF register logs to be played back by
+// sending a SysExPlayRegisterLog request, followed by the file contents.
+// MIDI input is ignored until playback finishes.
+//#define WITH_REGISTER_PLAYER
+
+// Define this to measure how long note-ons take to be played, which can be
+// retrieved by sending a SysExDumpLatency request
+//#define WITH_LATENCY_HISTOGRAM
+
+// Define this to report SRAM usage (including how deep the stack has been
+// and the size of each of the objects below) when a SysExDumpMemoryUsage
+// request is sent
+//#define WITH_MEMORY_USAGE
+
+// Profiling is enabled by defining WITH_PROFILER in Profiler.h. The results
+// can be retrieved by sending a SysExDumpProfile request. This uses Timer1,
+// so the diagnostic LED will not fade.
+
 #include "ISAPlugAndPlay.h"
 #include "ISABus.h"
 #include "OPL3SA.h"
@@ -26,11 +48,23 @@
 #include "MIDI.h"
 #include "ISRState.h"
 #include "MIDIControl.h"
+#include "OPL3RegisterLog.h"
+#include "OPL3RegisterPlayer.h"
+#include "LatencyHistogram.h"
+#include "Profiler.h"
+#include "MemoryUsage.h"
+#include "SysExBuffer.h"
+#include "SysExPatch.h"
 
 const uint16_t mpu401IoBaseAddress  = 0x330;
 const uint8_t  mpu401IRQ            = 5;
 const uint16_t opl3IoBaseAddress    = 0x388;
 
+// When MAX_OPL3_CHIPS (in MIDIControl.h) is more than 1, notes are also
+// played on an OPL3 here, if one is found. Only the first card is configured
+// through Plug and Play, so this one must already be set up to use it.
+const uint16_t secondOpl3IoBaseAddress = 0x38c;
+
 const uint8_t mpu401IntPin = 2;
 const uint8_t readyPin = 4;
 const uint8_t isaReadPin = 5;
@@ -53,7 +87,223 @@ OPL3SA opl3sa(isaBus);
 MPU401 mpu401(isaBus);
 OPL3::Hardware opl3(isaBus, opl3IoBaseAddress);
 
+#if MAX_OPL3_CHIPS > 1
+OPL3::Hardware secondOpl3(isaBus, secondOpl3IoBaseAddress);
+#endif
+
 MIDIBuffer midiBuffer;
+SysExBuffer sysExBuffer;
+
+#ifdef WITH_REGISTER_LOG
+OPL3::RegisterLog registerLog;
+#endif
+
+MIDIControl midiControl(opl3);
+SysExPatchLoader patchLoader(midiControl);
+
+#ifdef WITH_REGISTER_PLAYER
+OPL3::RegisterPlayer registerPlayer(opl3);
+unsigned long registerPlayerInputMillis = 0;
+#endif
+
+#ifdef WITH_LATENCY_HISTOGRAM
+LatencyHistogram latencyHistogram;
+
+void latencyKeyOn()
+{
+    latencyHistogram.keyOn();
+}
+#endif
+
+/*
+    Answers a store or recall request (see SysExBuffer.h)
+*/
+
+void sendResult(
+    uint8_t command,
+    bool success)
+{
+    Serial.write(0xf0);
+    Serial.write(SYSEX_MANUFACTURER_ID);
+    Serial.write(command);
+    Serial.write(success ? 1 : 0);
+    Serial.write(0xf7);
+}
+
+/*
+    Patch dumps are sent in the same form as the message which loads them
+    (see SysExPatch.h)
+*/
+
+void sendPatchDump(
+    uint8_t command,
+    uint8_t firstChannel,
+    uint8_t numberOfChannels)
+{
+    ChannelPatch patch;
+    uint8_t data[SYSEX_PATCH_LENGTH];
+
+    Serial.write(0xf0);
+    Serial.write(SYSEX_MANUFACTURER_ID);
+    Serial.write(command);
+
+    if (numberOfChannels == 1) {
+        Serial.write(firstChannel);
+    }
+
+    for (uint8_t i = 0; i < numberOfChannels; ++ i) {
+        midiControl.getChannelPatch(firstChannel + i, patch);
+        packPatch(patch, data);
+        Serial.write(data, sizeof(data));
+    }
+
+    Serial.write(0xf7);
+}
+
+/*
+    Handle Canyon SysEx messages (see SysExBuffer.h)
+*/
+
+void processSysEx()
+{
+    const uint8_t *data = sysExBuffer.getData();
+
+    if ((sysExBuffer.getLength() < 2) || (data[0] != SYSEX_MANUFACTURER_ID)) {
+        return;
+    }
+
+    switch (data[1]) {
+        case SysExStorePatch:
+            sendResult(SysExStorePatch,
+                       (sysExBuffer.getLength() >= 4) && (midiControl.storePatch(data[2], data[3])));
+            break;
+
+        case SysExRecallPatch:
+            sendResult(SysExRecallPatch,
+                       (sysExBuffer.getLength() >= 4) && (midiControl.recallPatch(data[2], data[3])));
+            break;
+
+        case SysExDumpPatch:
+            if ((sysExBuffer.getLength() >= 3) && (data[2] < NUMBER_OF_MIDI_CHANNELS)) {
+                sendPatchDump(SysExLoadPatch, data[2], 1);
+            }
+            break;
+
+        case SysExDumpSetup:
+            sendPatchDump(SysExLoadSetup, 0, NUMBER_OF_MIDI_CHANNELS);
+            break;
+
+        case SysExSetZone:
+            if ((sysExBuffer.getLength() >= 11) && (data[3] < NUMBER_OF_MIDI_CHANNELS)
+             && (data[4] < NUMBER_OF_MIDI_CHANNELS)) {
+                Zone zone;
+
+                zone.enabled = true;
+                zone.inputChannel = data[3];
+                zone.targetChannel = data[4];
+                zone.lowNote = data[5];
+                zone.highNote = data[6];
+                zone.lowVelocity = data[7];
+                zone.highVelocity = data[8];
+                zone.program = data[9];
+                zone.transpose = (int8_t)data[10] - 64;
+
+                midiControl.setZone(data[2], zone);
+            }
+            break;
+
+        case SysExClearZone:
+            if (sysExBuffer.getLength() >= 3) {
+                Zone zone;
+
+                memset(&zone, 0, sizeof(zone));
+                midiControl.setZone(data[2], zone);
+            }
+            break;
+
+#ifdef WITH_REGISTER_LOG
+        case SysExDumpRegisterLog:
+            registerLog.dump(Serial);
+            break;
+#endif
+
+#ifdef WITH_REGISTER_PLAYER
+        case SysExPlayRegisterLog:
+            if ((sysExBuffer.getLength() < 3) || (data[2] > OPL3::IMF700Format)) {
+                break;
+            }
+
+            // All Sound Off
+            for (uint8_t channel = 0; channel < 16; ++ channel) {
+                midiControl.setController(channel, 120, 0);
+            }
+
+            registerPlayer.begin((OPL3::RegisterLogFormat)data[2]);
+            registerPlayerInputMillis = millis();
+            break;
+#endif
+
+#ifdef WITH_LATENCY_HISTOGRAM
+        case SysExDumpLatency:
+            latencyHistogram.dump(Serial);
+            break;
+#endif
+
+#ifdef WITH_PROFILER
+        case SysExDumpProfile:
+            dumpProfile(Serial);
+            break;
+#endif
+
+#ifdef WITH_MEMORY_USAGE
+        case SysExDumpMemoryUsage:
+            dumpMemoryUsage(Serial);
+            printObjectSize(Serial, F("isaBus"), sizeof(isaBus));
+            printObjectSize(Serial, F("opl3sa"), sizeof(opl3sa));
+            printObjectSize(Serial, F("mpu401"), sizeof(mpu401));
+            printObjectSize(Serial, F("opl3"), sizeof(opl3));
+            printObjectSize(Serial, F("midiBuffer"), sizeof(midiBuffer));
+            printObjectSize(Serial, F("sysExBuffer"), sizeof(sysExBuffer));
+            printObjectSize(Serial, F("midiControl"), sizeof(midiControl));
+            printObjectSize(Serial, F("patchLoader"), sizeof(patchLoader));
+#ifdef WITH_REGISTER_LOG
+            printObjectSize(Serial, F("registerLog"), sizeof(registerLog));
+#endif
+#ifdef WITH_REGISTER_PLAYER
+            printObjectSize(Serial, F("registerPlayer"), sizeof(registerPlayer));
+#endif
+#ifdef WITH_LATENCY_HISTOGRAM
+            printObjectSize(Serial, F("latencyHistogram"), sizeof(latencyHistogram));
+#endif
+            break;
+#endif
+
+        default:
+            break;
+    };
+}
+
+/*
+    Patch loads are too big for the SysEx buffer, so once the start of one
+    has been buffered the rest goes to the patch loader as it arrives
+*/
+
+void startSysExStream()
+{
+    const uint8_t *data = sysExBuffer.getData();
+
+    if ((sysExBuffer.getLength() < 2) || (data[0] != SYSEX_MANUFACTURER_ID)) {
+        return;
+    }
+
+    if ((data[1] == SysExLoadPatch) && (sysExBuffer.getLength() == 3)) {
+        patchLoader.begin(data[2], 1);
+        sysExBuffer.stream();
+    } else if ((data[1] == SysExLoadSetup) && (sysExBuffer.getLength() == 2)) {
+        patchLoader.begin(0, NUMBER_OF_MIDI_CHANNELS);
+        sysExBuffer.stream();
+    }
+}
 
 /*
     Handle MIDI input through the serial pin
@@ -69,17 +319,59 @@ void processSerialInput()
         0, {0, 0}
     };
 
+#ifdef WITH_LATENCY_HISTOGRAM
+    static unsigned long messageMicros = 0;
+    static bool messageTimed = false;
+#endif
+
     while (Serial.available()) {
         data = Serial.read();
 
+        if (sysExBuffer.receive(data)) {
+            // SysEx cancels any running status
+            message.status = 0;
+            length = 0;
+
+            if (sysExBuffer.isComplete()) {
+                processSysEx();
+                sysExBuffer.clear();
+
+#ifdef WITH_REGISTER_PLAYER
+                // Anything after this is the register log, which is left for
+                // serviceRegisterPlayer
+                if (registerPlayer.isPlaying()) {
+                    return;
+                }
+#endif
+            } else if (sysExBuffer.isStreaming()) {
+                patchLoader.put(data);
+            } else {
+                startSysExStream();
+            }
+
+            continue;
+        }
+
         if (data & 0x80) {
             // Status byte
             message.status = data;
             length = 1;
+#ifdef WITH_LATENCY_HISTOGRAM
+            messageMicros = micros();
+            messageTimed = true;
+#endif
         } else if (message.status == 0) {
             // Unknown status - skip
             continue;
         } else {
+#ifdef WITH_LATENCY_HISTOGRAM
+            if (!messageTimed) {
+                // Running status, so the message starts here
+                messageMicros = micros();
+                messageTimed = true;
+            }
+#endif
+
             // Data byte
             message.data[length - 1] = data;
 
@@ -96,12 +388,63 @@ void processSerialInput()
         } else if (length == expectedLength) {
             midiBuffer.put(message);
 
+#ifdef WITH_LATENCY_HISTOGRAM
+            if (((message.status & 0xf0) == 0x90) && (message.data[1] > 0)) {
+                latencyHistogram.received(message.status & 0x0f, message.data[0], messageMicros);
+            }
+
+            messageTimed = false;
+#endif
+
             // Keep the status byte for the next message
             length = 1;
         }
     }
 }
 
+#ifdef WITH_REGISTER_PLAYER
+/*
+    Feed the register log coming in through the serial pin to the player.
+    Type 0 IMF files don't indicate where they end, so the input is also
+    treated as finished if nothing arrives for a second.
+
+    Once playback finishes, the OPL3 is put back into a known state for MIDI.
+*/
+
+void serviceRegisterPlayer()
+{
+    // MIDI input is ignored during playback (receiveMpu401Data discards it
+    // when interrupts are used)
+    #ifndef USE_MPU401_INTERRUPTS
+    while (mpu401.canRead()) {
+        mpu401.readData();
+    }
+    #endif
+
+    while (Serial.available()) {
+        if (!registerPlayer.put(Serial.peek())) {
+            break;
+        }
+
+        Serial.read();
+    }
+
+    if (Serial.available()) {
+        // Waiting for the player to make space doesn't count as idle
+        registerPlayerInputMillis = millis();
+    } else if (millis() - registerPlayerInputMillis > 1000) {
+        registerPlayer.end();
+    }
+
+    registerPlayer.service();
+
+    if (!registerPlayer.isPlaying()) {
+        opl3.init();
+        midiControl.init();
+    }
+}
+#endif
+
 /*
     Joystick/MIDI port handling
     IRQ 5 is raised whenever MIDI data is ready on the MPU-401 UART port. This
@@ -118,19 +461,45 @@ void receiveMpu401Data()
         0, {0, 0}
     };
 
+#ifdef WITH_LATENCY_HISTOGRAM
+    static unsigned long messageMicros = 0;
+    static bool messageTimed = false;
+#endif
+
     isrBegin();
 
     while (mpu401.canRead()) {
         data = mpu401.readData();
 
+#ifdef WITH_REGISTER_PLAYER
+        // MIDI input is ignored during playback
+        if (registerPlayer.isPlaying()) {
+            message.status = 0;
+            length = 0;
+            continue;
+        }
+#endif
+
         if (data & 0x80) {
             // Status byte
             message.status = data;
             length = 1;
+#ifdef WITH_LATENCY_HISTOGRAM
+            messageMicros = micros();
+            messageTimed = true;
+#endif
         } else if (message.status == 0) {
             // Unknown status - skip
             continue;
         } else {
+#ifdef WITH_LATENCY_HISTOGRAM
+            if (!messageTimed) {
+                // Running status, so the message starts here
+                messageMicros = micros();
+                messageTimed = true;
+            }
+#endif
+
             // Data byte
             message.data[length - 1] = data;
 
@@ -147,6 +516,14 @@ void receiveMpu401Data()
         } else if (length == expectedLength) {
             midiBuffer.put(message);
 
+#ifdef WITH_LATENCY_HISTOGRAM
+            if (((message.status & 0xf0) == 0x90) && (message.data[1] > 0)) {
+                latencyHistogram.received(message.status & 0x0f, message.data[0], messageMicros);
+            }
+
+            messageTimed = false;
+#endif
+
             // Keep the status byte for the next message
             length = 1;
         }
@@ -178,12 +555,14 @@ void fail(int count)
     }
 }
 
-MIDIControl midiControl(opl3);
-
 void setup()
 {
     long startTime = millis();
 
+#ifdef WITH_PROFILER
+    initProfiler();
+#endif
+
     // This LED will stay on during initialisation
     pinMode(diagnosticLedPin, OUTPUT);
     digitalWrite(diagnosticLedPin, HIGH);
@@ -218,9 +597,34 @@ void setup()
 #endif
         fail(2);
     }
+#ifdef WITH_REGISTER_LOG
+    // Start recording before init() so the log contains the complete state
+    opl3.setRegisterLog(&registerLog);
+#endif
+#ifdef WITH_LATENCY_HISTOGRAM
+    opl3.setKeyOnHandler(latencyKeyOn);
+#endif
     opl3.init();
 #ifdef WITH_SERIAL
     Serial.println("Done");
+#endif
+#if MAX_OPL3_CHIPS > 1
+#ifdef WITH_SERIAL
+    Serial.print("Initialising second OPL3... ");
+#endif
+    if (secondOpl3.detect()) {
+        secondOpl3.init();
+        midiControl.addChip(secondOpl3);
+#ifdef WITH_SERIAL
+        Serial.println("Done");
+#endif
+    } else {
+#ifdef WITH_SERIAL
+        Serial.println("Not found");
+#endif
+    }
+#endif
+#ifdef WITH_SERIAL
     Serial.print("Initialising MPU-401... ");
 #endif
     mpu401.init(mpu401IoBaseAddress);
@@ -310,13 +714,25 @@ void serviceMidiInput()
                     break;
 
                 case 0x90:
+#ifdef WITH_LATENCY_HISTOGRAM
+                    if (message.data[1] > 0) {
+                        latencyHistogram.beginNoteOn(channel, message.data[0]);
+                    }
+#endif
                     midiControl.playNote(channel, message.data[0], message.data[1]);
+#ifdef WITH_LATENCY_HISTOGRAM
+                    latencyHistogram.endNoteOn();
+#endif
                     break;
 
                 case 0xb0:
                     midiControl.setController(channel, message.data[0], message.data[1]);
                     break;
 
+                case 0xc0:
+                    midiControl.setProgram(channel, message.data[0]);
+                    break;
+
                 case 0xe0:
                     midiControl.setPitchBend(channel, (uint16_t)(message.data[1] << 7) | message.data[0]);
                     break;
@@ -327,8 +743,8 @@ void serviceMidiInput()
 
 void loop()
 {
-    // This causes some output interference
-    #if 1
+    // This causes some output interference (and Timer1 is used for profiling)
+    #ifndef WITH_PROFILER
     if (diagnosticLedBrightness > 0) {
         if (++ diagnosticLedFrame > 100) {
             analogWrite(diagnosticLedPin, -- diagnosticLedBrightness);
@@ -337,6 +753,13 @@ void loop()
     }
     #endif
 
+#ifdef WITH_REGISTER_PLAYER
+    if (registerPlayer.isPlaying()) {
+        serviceRegisterPlayer();
+        return;
+    }
+#endif
+
     midiControl.service();
     serviceMidiInput();
 }
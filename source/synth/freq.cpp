@@ -1244,7 +1244,9 @@ uint32_t getNoteFrequency(
     }
 }
 
-#ifndef ARDUINO
+// Host tools that link against this define CANYON_HOST_TOOL to leave out the
+// test program
+#if !defined(ARDUINO) && !defined(CANYON_HOST_TOOL)
 #include <stdio.h>
 int main()
 {
@@ -0,0 +1,626 @@
+# Generate the General MIDI patch bank (bank.cpp) - see bank.h for the format
+#
+# Each of the 16 General MIDI instrument families has one patch, which is
+# used for all 8 programs in the family. Percussion notes use a handful of
+# 2-op melodic patches played at a fixed note, either on a melodic channel or
+# on one of the OPL3's rhythm mode voices (which only use the patch's output
+# operator, apart from the kick). Drums in the same choke group cut each
+# other off, e.g. a closed hi-hat stops an open one.
+#
+# Patches can also be converted from an existing OPL instrument library:
+#
+#   python genbank.py > bank.cpp                        (built-in patches)
+#   python genbank.py --sbi piano.sbi organ.sbi > bank.cpp
+#   python genbank.py --ibk bank.ibk > bank.cpp
+#   python genbank.py --op2 GENMIDI.OP2 > bank.cpp
+#   python genbank.py --wopl bank.wopl > bank.cpp
+#
+# Programs (and percussion notes) the library doesn't cover keep the built-in
+# patches. SBI files are assigned to programs in the order they're given.
+#
+# The file formats have no velocity sensitivity, so output operators get a
+# velocity-to-level of 40 and the rest 16, the same as most built-in patches.
+#
+# Pseudo 4-op (double voice) instruments are played on a 4-op channel with
+# the two voices in parallel (synth type 2) when both voices are FM, which
+# loses the detune between the voices and the second voice's feedback. Other
+# combinations can't be expressed on one channel and only use the first
+# voice, as do all pseudo 4-op instruments with --2op. Melodic note offsets
+# are ignored as the bank has nowhere to put them, but percussion offsets are
+# applied to the note that's played.
+
+import argparse
+import struct
+import sys
+
+MELODY_2OP = 1
+MELODY_4OP = 2
+
+# OPL3::ChannelType of the rhythm mode voices
+RHYTHM_VOICES = {'kick': 3, 'snare': 4, 'tom': 5, 'cymbal': 6, 'hihat': 7}
+
+
+def op(mult=1, tl=0, ar=15, dr=0, sl=0, rr=0, ksl=0, ws=0, egt=1, ksr=0,
+       vib=0, am=0, vtl=32):
+    """Operator as register bytes 0x20, 0x40 (level), 0x60, 0x80, 0xe0 and
+    velocity-to-level"""
+    return (
+        (am << 7) | (vib << 6) | (egt << 5) | (ksr << 4) | mult,
+        (ksl << 6) | (63 - tl),
+        (ar << 4) | dr,
+        (sl << 4) | rr,
+        ws,
+        vtl
+    )
+
+
+def patch(name, fb, mod, car, synth_type=0):
+    return {
+        'name': name,
+        'type': MELODY_2OP,
+        'feedback': fb,
+        'synth_type': synth_type,
+        'operators': [mod, car]
+    }
+
+
+families = [
+    patch('Piano', 3,
+          op(mult=1, tl=30, dr=3, sl=5, rr=3, ksl=1, egt=0, vtl=16),
+          op(mult=1, dr=2, sl=6, rr=4, egt=0, vtl=40)),
+    patch('Chromatic Percussion', 2,
+          op(mult=7, tl=36, dr=5, sl=8, rr=5, egt=0, vtl=16),
+          op(mult=1, dr=4, sl=7, rr=5, egt=0, vtl=40)),
+    patch('Organ', 0,
+          op(mult=2, tl=8, rr=7, vtl=24),
+          op(mult=1, rr=7, vtl=24),
+          synth_type=1),
+    patch('Guitar', 4,
+          op(mult=1, tl=28, dr=4, sl=6, rr=4, ws=1, egt=0, vtl=16),
+          op(mult=1, dr=3, sl=7, rr=5, egt=0, vtl=40)),
+    patch('Bass', 5,
+          op(mult=0, tl=24, dr=5, sl=5, rr=6, egt=0, vtl=16),
+          op(mult=1, dr=3, sl=4, rr=6, vtl=40)),
+    patch('Strings', 3,
+          op(mult=1, tl=26, ar=7, dr=1, sl=2, rr=6, vib=1, vtl=16),
+          op(mult=1, ar=6, dr=1, sl=1, rr=6, vib=1, vtl=32)),
+    patch('Ensemble', 2,
+          op(mult=2, tl=34, ar=6, dr=2, sl=3, rr=5, vtl=16),
+          op(mult=1, ar=6, dr=1, sl=2, rr=5, vib=1, vtl=32)),
+    patch('Brass', 5,
+          op(mult=1, tl=22, ar=11, dr=2, sl=2, rr=7, vtl=24),
+          op(mult=1, ar=10, dr=1, sl=1, rr=7, vtl=40)),
+    patch('Reed', 6,
+          op(mult=2, tl=26, ar=11, dr=2, sl=3, rr=7, vtl=24),
+          op(mult=1, ar=11, dr=1, sl=2, rr=7, vtl=40)),
+    patch('Pipe', 1,
+          op(mult=2, tl=40, ar=9, dr=2, sl=2, rr=7, vtl=16),
+          op(mult=1, ar=9, dr=1, sl=1, rr=7, vib=1, vtl=32)),
+    patch('Synth Lead', 6,
+          op(mult=1, tl=20, rr=7, ws=2, vtl=16),
+          op(mult=1, rr=7, ws=1, vtl=32)),
+    patch('Synth Pad', 3,
+          op(mult=1, tl=30, ar=4, dr=2, sl=2, rr=4, vib=1, vtl=16),
+          op(mult=1, ar=4, dr=1, sl=1, rr=4, vib=1, vtl=32)),
+    patch('Synth Effects', 7,
+          op(mult=3, tl=28, ar=5, dr=3, sl=4, rr=4, am=1, vtl=16),
+          op(mult=1, ar=5, dr=2, sl=3, rr=4, vtl=32)),
+    patch('Ethnic', 4,
+          op(mult=3, tl=30, dr=5, sl=7, rr=5, egt=0, vtl=16),
+          op(mult=1, dr=4, sl=8, rr=5, egt=0, vtl=40)),
+    patch('Percussive', 3,
+          op(mult=2, tl=26, dr=6, sl=10, rr=6, egt=0, vtl=16),
+          op(mult=1, dr=5, sl=9, rr=6, egt=0, vtl=40)),
+    patch('Sound Effects', 7,
+          op(mult=15, tl=20, ar=13, dr=4, sl=5, rr=3, vtl=16),
+          op(mult=1, ar=12, dr=3, sl=4, rr=3, vtl=32)),
+]
+
+drums = {
+    'kick': patch('Kick', 5,
+                  op(mult=0, tl=20, dr=8, sl=15, rr=8, egt=0, vtl=16),
+                  op(mult=0, dr=7, sl=15, rr=8, egt=0, vtl=48)),
+    'snare': patch('Snare', 7,
+                   op(mult=15, dr=7, sl=15, rr=7, egt=0, vtl=16),
+                   op(mult=1, dr=6, sl=15, rr=7, egt=0, vtl=48)),
+    'clap': patch('Clap', 7,
+                  op(mult=15, dr=8, sl=15, rr=8, egt=0, vtl=16),
+                  op(mult=2, dr=8, sl=15, rr=8, egt=0, vtl=48)),
+    'tom': patch('Tom', 3,
+                 op(mult=1, tl=30, dr=6, sl=15, rr=6, egt=0, vtl=16),
+                 op(mult=1, dr=5, sl=15, rr=6, egt=0, vtl=48)),
+    'closedhat': patch('Closed Hi-Hat', 7,
+                       op(mult=15, dr=9, sl=15, rr=9, egt=0, vtl=16),
+                       op(mult=13, dr=9, sl=15, rr=9, egt=0, vtl=48)),
+    'openhat': patch('Open Hi-Hat', 7,
+                     op(mult=15, dr=5, sl=15, rr=5, egt=0, vtl=16),
+                     op(mult=13, dr=5, sl=15, rr=5, egt=0, vtl=48)),
+    'cymbal': patch('Cymbal', 7,
+                    op(mult=15, dr=3, sl=15, rr=3, egt=0, vtl=16),
+                    op(mult=11, dr=3, sl=15, rr=3, egt=0, vtl=48)),
+    'block': patch('Wood Block', 2,
+                   op(mult=5, tl=30, dr=7, sl=15, rr=7, egt=0, vtl=16),
+                   op(mult=1, dr=6, sl=15, rr=7, egt=0, vtl=48)),
+}
+
+# General MIDI percussion notes 35 to 81: (name, patch, note to play,
+# rhythm voice or None for a melodic channel, choke group or 0 for none)
+percussion = [
+    ('Acoustic Bass Drum', 'kick', 22, 'kick', 0),
+    ('Bass Drum 1', 'kick', 24, 'kick', 0),
+    ('Side Stick', 'block', 72, None, 0),
+    ('Acoustic Snare', 'snare', 60, 'snare', 0),
+    ('Hand Clap', 'clap', 64, None, 0),
+    ('Electric Snare', 'snare', 62, 'snare', 0),
+    ('Low Floor Tom', 'tom', 41, 'tom', 0),
+    ('Closed Hi-Hat', 'closedhat', 84, 'hihat', 1),
+    ('High Floor Tom', 'tom', 43, 'tom', 0),
+    ('Pedal Hi-Hat', 'closedhat', 80, 'hihat', 1),
+    ('Low Tom', 'tom', 45, 'tom', 0),
+    ('Open Hi-Hat', 'openhat', 84, 'hihat', 1),
+    ('Low-Mid Tom', 'tom', 47, 'tom', 0),
+    ('Hi-Mid Tom', 'tom', 50, 'tom', 0),
+    ('Crash Cymbal 1', 'cymbal', 80, 'cymbal', 0),
+    ('High Tom', 'tom', 53, 'tom', 0),
+    ('Ride Cymbal 1', 'cymbal', 88, 'cymbal', 0),
+    ('Chinese Cymbal', 'cymbal', 76, 'cymbal', 0),
+    ('Ride Bell', 'block', 84, None, 0),
+    ('Tambourine', 'closedhat', 90, None, 0),
+    ('Splash Cymbal', 'cymbal', 86, 'cymbal', 0),
+    ('Cowbell', 'block', 68, None, 0),
+    ('Crash Cymbal 2', 'cymbal', 78, 'cymbal', 0),
+    ('Vibraslap', 'openhat', 70, None, 0),
+    ('Ride Cymbal 2', 'cymbal', 86, 'cymbal', 0),
+    ('Hi Bongo', 'tom', 64, None, 0),
+    ('Low Bongo', 'tom', 60, None, 0),
+    ('Mute Hi Conga', 'tom', 62, None, 0),
+    ('Open Hi Conga', 'tom', 60, None, 0),
+    ('Low Conga', 'tom', 55, None, 0),
+    ('High Timbale', 'tom', 67, None, 0),
+    ('Low Timbale', 'tom', 62, None, 0),
+    ('High Agogo', 'block', 84, None, 0),
+    ('Low Agogo', 'block', 79, None, 0),
+    ('Cabasa', 'closedhat', 96, None, 0),
+    ('Maracas', 'closedhat', 100, None, 0),
+    ('Short Whistle', 'block', 96, None, 2),
+    ('Long Whistle', 'block', 91, None, 2),
+    ('Short Guiro', 'closedhat', 72, None, 3),
+    ('Long Guiro', 'openhat', 72, None, 3),
+    ('Claves', 'block', 84, None, 0),
+    ('Hi Wood Block', 'block', 79, None, 0),
+    ('Low Wood Block', 'block', 74, None, 0),
+    ('Mute Cuica', 'tom', 72, None, 4),
+    ('Open Cuica', 'tom', 67, None, 4),
+    ('Mute Triangle', 'block', 96, None, 5),
+    ('Open Triangle', 'block', 96, None, 5),
+]
+
+
+
+def convert_operator(registers, output):
+    """Operator from register bytes 0x20, 0x40, 0x60, 0x80 and 0xe0"""
+    return (
+        registers[0],
+        (registers[1] & 0xc0) | (63 - (registers[1] & 0x3f)),
+        registers[2],
+        registers[3],
+        registers[4] & 0x07,
+        40 if output else 16
+    )
+
+
+def convert_2op(name, c0, mod, car):
+    """2-op patch from the 0xc0 register and modulator / carrier registers"""
+    additive = c0 & 0x01
+    return {
+        'name': name,
+        'type': MELODY_2OP,
+        'feedback': (c0 >> 1) & 0x07,
+        'synth_type': additive,
+        'operators': [convert_operator(mod, additive),
+                      convert_operator(car, True)]
+    }
+
+
+# Operators which reach the output for each 4-op synth type
+OUTPUT_OPERATORS_4OP = [(3,), (0, 3), (1, 3), (0, 2, 3)]
+
+
+def convert_4op(name, c0, c0_second, operators):
+    """4-op patch from the 0xc0 registers of both channels and 4 operators
+    in register order"""
+    synth_type = (c0 & 0x01) | ((c0_second & 0x01) << 1)
+    return {
+        'name': name,
+        'type': MELODY_4OP,
+        'feedback': (c0 >> 1) & 0x07,
+        'synth_type': synth_type,
+        'operators': [convert_operator(registers,
+                                       index in OUTPUT_OPERATORS_4OP[synth_type])
+                      for index, registers in enumerate(operators)]
+    }
+
+
+def convert_double_voice(name, c0, mod, car, c0_second, mod_second, car_second,
+                         use_4op):
+    """Pseudo 4-op patch, made of two independent 2-op voices"""
+    if use_4op and not (c0 & 0x01) and not (c0_second & 0x01):
+        # Both voices are FM, so they can be played in parallel (op 1 -> op 2
+        # and op 3 -> op 4)
+        return convert_4op(name, c0 & 0x0e, 0x01,
+                           [mod, car, mod_second, car_second])
+
+    return convert_2op(name, c0, mod, car)
+
+
+def clean_name(data):
+    name = data.split(b'\0')[0].decode('latin-1').strip()
+    return ''.join(c if 32 <= ord(c) < 127 else '?' for c in name)
+
+
+def read_file(filename):
+    with open(filename, 'rb') as f:
+        return f.read()
+
+
+def fail(message):
+    sys.stderr.write('genbank.py: {}\n'.format(message))
+    sys.exit(1)
+
+
+def convert_sbi_data(name, data):
+    """SBI / IBK instrument: 0x20, 0x40, 0x60, 0x80 and 0xe0 alternating
+    between modulator and carrier, then 0xc0"""
+    return convert_2op(name, data[10], data[0:10:2], data[1:10:2])
+
+
+def read_sbi(filenames):
+    programs = {}
+
+    for program, filename in enumerate(filenames):
+        data = read_file(filename)
+
+        if (len(data) < 47) or (data[0:4] != b'SBI\x1a'):
+            fail('{} is not an SBI file'.format(filename))
+
+        if program >= 128:
+            fail('more than 128 SBI files')
+
+        programs[program] = convert_sbi_data(clean_name(data[4:36]), data[36:47])
+
+    return programs, {}
+
+
+def read_ibk(filename):
+    data = read_file(filename)
+
+    if (len(data) < 4 + 128 * 16 + 128 * 9) or (data[0:4] != b'IBK\x1a'):
+        fail('{} is not an IBK file'.format(filename))
+
+    programs = {}
+
+    for program in range(0, 128):
+        instrument = data[4 + program * 16:4 + program * 16 + 11]
+        offset = 4 + 128 * 16 + program * 9
+        programs[program] = convert_sbi_data(clean_name(data[offset:offset + 9]),
+                                             instrument)
+
+    return programs, {}
+
+
+OP2_INSTRUMENTS = 175
+OP2_FIXED_PITCH = 0x0001
+OP2_DOUBLE_VOICE = 0x0004
+
+
+def read_op2(filename, use_4op):
+    """DMX GENMIDI.OP2 - 128 melodic instruments then 47 percussion
+    instruments for notes 35 to 81"""
+    data = read_file(filename)
+
+    if (len(data) < 8 + OP2_INSTRUMENTS * 68) or (data[0:8] != b'#OPL_II#'):
+        fail('{} is not a GENMIDI.OP2 file'.format(filename))
+
+    programs = {}
+    percussion_notes = {}
+
+    for index in range(0, OP2_INSTRUMENTS):
+        offset = 8 + index * 36
+        flags, fine_tune, fixed_note = struct.unpack_from('<HBB', data, offset)
+        name_offset = 8 + OP2_INSTRUMENTS * 36 + index * 32
+        name = clean_name(data[name_offset:name_offset + 32])
+
+        voices = []
+        for voice in range(0, 2):
+            v = data[offset + 4 + voice * 16:offset + 4 + voice * 16 + 16]
+            # Operator registers are stored 0x20, 0x60, 0x80, 0xe0, then key
+            # scale level and level for 0x40
+            mod = (v[0], v[4] | v[5], v[1], v[2], v[3])
+            car = (v[7], v[11] | v[12], v[8], v[9], v[10])
+            note_offset = struct.unpack_from('<h', v, 14)[0]
+            voices.append((v[6], mod, car, note_offset))
+
+        if flags & OP2_DOUBLE_VOICE:
+            p = convert_double_voice(name, voices[0][0], voices[0][1], voices[0][2],
+                                     voices[1][0], voices[1][1], voices[1][2],
+                                     use_4op)
+        else:
+            p = convert_2op(name, voices[0][0], voices[0][1], voices[0][2])
+
+        if index < 128:
+            programs[index] = p
+        else:
+            # As DMX does, unpitched percussion is played at middle C
+            note = fixed_note if flags & OP2_FIXED_PITCH else 60
+            note = min(max(note + voices[0][3], 0), 127)
+            percussion_notes[index - 128 + 35] = (p, note)
+
+    return programs, percussion_notes
+
+
+WOPL_4OP = 0x01
+WOPL_PSEUDO_4OP = 0x02
+WOPL_BLANK = 0x04
+
+
+def read_wopl(filename, use_4op):
+    """OPL3 Bank Editor / libADLMIDI bank - only the first melodic and
+    percussion banks are used"""
+    data = read_file(filename)
+
+    if (len(data) < 19) or (data[0:11] != b'WOPL3-BANK\0'):
+        fail('{} is not a WOPL file'.format(filename))
+
+    version = struct.unpack_from('<H', data, 11)[0]
+    melodic_banks, percussion_banks = struct.unpack_from('>HH', data, 13)
+    offset = 19
+
+    if version >= 2:
+        offset += (melodic_banks + percussion_banks) * 34
+
+    instrument_size = 66 if version >= 3 else 62
+
+    if len(data) < offset + (melodic_banks + percussion_banks) * 128 * instrument_size:
+        fail('{} is truncated'.format(filename))
+
+    def read_instrument(index):
+        i = data[offset + index * instrument_size:offset + (index + 1) * instrument_size]
+        name = clean_name(i[0:32])
+        note_offset = struct.unpack_from('>h', i, 32)[0]
+        key, flags, c0, c0_second = i[38], i[39], i[40], i[41]
+
+        # Stored carrier 1, modulator 1, carrier 2, modulator 2
+        ops = [tuple(i[42 + op * 5:42 + op * 5 + 5]) for op in range(0, 4)]
+
+        if flags & WOPL_BLANK:
+            p = None
+        elif flags & WOPL_4OP:
+            p = convert_4op(name, c0, c0_second, [ops[1], ops[0], ops[3], ops[2]])
+        elif flags & WOPL_PSEUDO_4OP:
+            p = convert_double_voice(name, c0, ops[1], ops[0], c0_second, ops[3],
+                                     ops[2], use_4op)
+        else:
+            p = convert_2op(name, c0, ops[1], ops[0])
+
+        return p, key, note_offset
+
+    programs = {}
+    percussion_notes = {}
+
+    if melodic_banks > 0:
+        for program in range(0, 128):
+            p, key, note_offset = read_instrument(program)
+            if p:
+                programs[program] = p
+
+    if percussion_banks > 0:
+        for note in range(35, 82):
+            p, key, note_offset = read_instrument(melodic_banks * 128 + note)
+            if p:
+                play_note = min(max((key if key else note) + note_offset, 0), 127)
+                percussion_notes[note] = (p, play_note)
+
+    return programs, percussion_notes
+
+
+parser = argparse.ArgumentParser(description='Generate bank.cpp')
+source = parser.add_mutually_exclusive_group()
+source.add_argument('--sbi', nargs='+', metavar='FILE', help='SBI instruments')
+source.add_argument('--ibk', metavar='FILE', help='IBK bank')
+source.add_argument('--op2', metavar='FILE', help='DMX GENMIDI.OP2 bank')
+source.add_argument('--wopl', metavar='FILE', help='WOPL bank')
+parser.add_argument('--2op', dest='use_4op', action='store_false',
+                    help='only use the first voice of pseudo 4-op instruments')
+args = parser.parse_args()
+
+programs = dict((program, families[program // 8]) for program in range(0, 128))
+percussion_notes = dict((index + 35, (drums[drum], note))
+                        for index, (name, drum, note, voice, choke)
+                        in enumerate(percussion))
+
+if args.sbi:
+    converted = read_sbi(args.sbi)
+elif args.ibk:
+    converted = read_ibk(args.ibk)
+elif args.op2:
+    converted = read_op2(args.op2, args.use_4op)
+elif args.wopl:
+    converted = read_wopl(args.wopl, args.use_4op)
+else:
+    converted = ({}, {})
+
+programs.update(converted[0])
+percussion_notes.update(converted[1])
+
+# Identical operators and patches are only stored once
+operators = []
+operator_indices = {}
+patches = []
+patch_indices = {}
+
+
+def add_patch(p):
+    indices = []
+    for operator in p['operators']:
+        if operator not in operator_indices:
+            operator_indices[operator] = len(operators)
+            operators.append((operator, p['name']))
+        indices.append(operator_indices[operator])
+
+    key = (p['type'], p['feedback'], p['synth_type'], tuple(indices))
+    if key not in patch_indices:
+        patch_indices[key] = len(patches)
+        patches.append((p, indices))
+
+    return patch_indices[key]
+
+
+program_patches = [add_patch(programs[program]) for program in range(0, 128)]
+percussion_patches = [(add_patch(percussion_notes[note][0]), percussion_notes[note][1])
+                      for note in range(35, 82)]
+
+if len(operators) > 512:
+    fail('{} operators, only 512 fit (try --2op)'.format(len(operators)))
+
+if len(patches) > 256:
+    fail('{} patches, only 256 fit'.format(len(patches)))
+
+sys.stderr.write('{} operators, {} patches\n'.format(len(operators), len(patches)))
+
+
+def hex_bytes(values):
+    return ', '.join('0x{:02x}'.format(value) for value in values)
+
+
+print("""#include "bank.h"
+
+#ifdef ARDUINO
+    #include <avr/pgmspace.h>
+#else
+    #include <string.h>
+    #define PROGMEM
+#endif
+
+static_assert(sizeof(OperatorPatch) == 6, "OperatorPatch must match the bank");
+static_assert(sizeof(BankPatch) == 6, "BankPatch must match the bank");
+static_assert(sizeof(BankDrum) == 2, "BankDrum must match the bank");
+
+// Registers 0x20, 0x40 (level), 0x60, 0x80, 0xe0 and velocity-to-level
+const PROGMEM static uint8_t bankOperators[{}][6] = {{""".format(len(operators)))
+
+for index, (operator, name) in enumerate(operators):
+    suffix = ',' if index < len(operators) - 1 else ''
+    print('    {{{}}}{} // {}: {}'.format(hex_bytes(operator), suffix, index, name))
+
+print("""}};
+
+// Channel type | (bit 8 of each operator << 3), feedback | (synth type << 3),
+// low 8 bits of each operator
+const PROGMEM static uint8_t bankPatches[{}][6] = {{""".format(len(patches)))
+
+for index, (p, indices) in enumerate(patches):
+    indices = indices + [0] * (4 - len(indices))
+    high = sum(((i >> 8) & 1) << n for n, i in enumerate(indices))
+    values = [p['type'] | (high << 3), p['feedback'] | (p['synth_type'] << 3)] \
+        + [i & 0xff for i in indices]
+    suffix = ',' if index < len(patches) - 1 else ''
+    print('    {{{}}}{} // {}: {}'.format(', '.join(str(v) for v in values), suffix,
+                                         index, p['name']))
+
+print("""};
+
+// Patch for each program
+const PROGMEM static uint8_t programPatches[BANK_PROGRAMS] = {""")
+
+for program, index in enumerate(program_patches):
+    suffix = ',' if program < 127 else ''
+    print('    {}{} // {}: {}'.format(index, suffix, program, programs[program]['name']))
+
+print("""};
+
+// Patch, note to play and voice | (choke group << 3) for each percussion note
+const PROGMEM static uint8_t percussionPatches[BANK_LAST_PERCUSSION_NOTE - BANK_FIRST_PERCUSSION_NOTE + 1][3] = {""")
+
+for index, (patch_index, note) in enumerate(percussion_patches):
+    name, drum, default_note, voice, choke = percussion[index]
+    voice = RHYTHM_VOICES[voice] if voice else MELODY_2OP
+    suffix = ',' if index < len(percussion_patches) - 1 else ''
+    print('    {{{}, {}, {}}}{} // {}: {}'.format(patch_index, note, voice | (choke << 3),
+                                             suffix, index + 35, name))
+
+print("""};
+
+static void getPatch(
+    uint8_t index,
+    BankPatch &patch)
+{
+#ifdef ARDUINO
+    memcpy_P(&patch, bankPatches[index], sizeof(patch));
+#else
+    memcpy(&patch, bankPatches[index], sizeof(patch));
+#endif
+}
+
+bool getProgramPatch(
+    uint8_t program,
+    BankPatch &patch)
+{
+    if (program >= BANK_PROGRAMS)
+        return false;
+
+#ifdef ARDUINO
+    getPatch(pgm_read_byte_near(programPatches + program), patch);
+#else
+    getPatch(programPatches[program], patch);
+#endif
+
+    return true;
+}
+
+bool getPercussionDrum(
+    uint8_t note,
+    BankDrum &drum)
+{
+    if ((note < BANK_FIRST_PERCUSSION_NOTE) || (note > BANK_LAST_PERCUSSION_NOTE))
+        return false;
+
+    note -= BANK_FIRST_PERCUSSION_NOTE;
+
+#ifdef ARDUINO
+    memcpy_P(&drum, &percussionPatches[note][1], sizeof(drum));
+#else
+    memcpy(&drum, &percussionPatches[note][1], sizeof(drum));
+#endif
+
+    return true;
+}
+
+bool getPercussionPatch(
+    uint8_t note,
+    BankPatch &patch,
+    BankDrum &drum)
+{
+    if (!getPercussionDrum(note, drum))
+        return false;
+
+    note -= BANK_FIRST_PERCUSSION_NOTE;
+
+#ifdef ARDUINO
+    getPatch(pgm_read_byte_near(&percussionPatches[note][0]), patch);
+#else
+    getPatch(percussionPatches[note][0], patch);
+#endif
+
+    return true;
+}
+
+void getOperatorPatch(
+    uint16_t index,
+    OperatorPatch &operatorPatch)
+{
+#ifdef ARDUINO
+    memcpy_P(&operatorPatch, bankOperators[index], sizeof(operatorPatch));
+#else
+    memcpy(&operatorPatch, bankOperators[index], sizeof(operatorPatch));
+#endif
+}""")
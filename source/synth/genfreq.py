@@ -85,7 +85,9 @@ print("""    };
     }
 }
 
-#ifndef ARDUINO
+// Host tools that link against this define CANYON_HOST_TOOL to leave out the
+// test program
+#if !defined(ARDUINO) && !defined(CANYON_HOST_TOOL)
 #include <stdio.h>
 int main()
 {
@@ -0,0 +1,46 @@
+# Generate a table of a * b / 63 for all a and b from 0 to 63, which is how
+# operator levels are scaled by velocity and channel volume
+#
+# As a * b == b * a, only the values where a >= b are stored (2080 bytes)
+
+print("""#include "level.h"
+
+#ifdef ARDUINO
+    #include <avr/pgmspace.h>
+#else
+    #define PROGMEM
+#endif
+
+uint8_t scaleLevel(
+    uint8_t level,
+    uint8_t scale)
+{
+    const PROGMEM static uint8_t levelTable[2080] = {""")
+
+for a in range(0, 64):
+    values = ', '.join(str((a * b) // 63) for b in range(0, a + 1))
+    suffix = '' if a == 63 else ','
+    print('        {}{} // {}'.format(values, suffix, a))
+
+print("""    };
+
+    uint16_t index;
+
+    if (level > 63)
+        level = 63;
+
+    if (scale > 63)
+        scale = 63;
+
+    if (level >= scale) {
+        index = ((level * (level + 1)) >> 1) + scale;
+    } else {
+        index = ((scale * (scale + 1)) >> 1) + level;
+    }
+
+#ifdef ARDUINO
+    return pgm_read_byte_near(levelTable + index);
+#else
+    return levelTable[index];
+#endif
+}""")
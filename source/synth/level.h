@@ -0,0 +1,12 @@
+#ifndef CANYON_LEVEL_H
+#define CANYON_LEVEL_H 1
+
+#include <stdint.h>
+
+// Returns level * scale / 63 (rounded down), for levels and scales from 0 to
+// 63. This avoids a 16-bit division on the Arduino.
+uint8_t scaleLevel(
+    uint8_t level,
+    uint8_t scale);
+
+#endif
@@ -5,8 +5,19 @@
     License:    See license.txt
     Date:       July 2018
 
-    At the moment, this just displays whatever I/O addresses are being accessed.
-    All input is returned as 0xFF.
+    At the moment, this just displays whatever I/O addresses are being accessed
+    (unless constructed as non-verbose) and counts them. All input is returned
+    as 0xFF.
+
+    Each access is charged the time the real ISA bus code would take, and the
+    simulated clock (see Timing.h) is moved forward by that amount. The real
+    code's steps are followed closely, including the ISA_*_DELAY delays and
+    the saving made by batching writes. So millis() and micros() seen by code
+    under test behave much as they would on the device.
+
+    A hash of every write (address and data, but not timing) is kept so that
+    the register streams from two runs can be compared cheaply. This is 64-bit
+    FNV-1a.
 
     It could be extended to simulate devices being available at specific
     addresses (e.g. attach a device object), which could provide some more
@@ -14,26 +25,252 @@
 */
 
 #include <stdio.h>
-#include "ISABus.h"
+#include "../ISABus.h"
+#include "../Profiler.h"
+#include "Timing.h"
+
+#define FNV_OFFSET_BASIS    0xcbf29ce484222325ULL
+#define FNV_PRIME           0x100000001b3ULL
 
-ISABus::ISABus()
+// The SPI clock is at most half the CPU clock
+#define AVR_CPU_CLOCK       16000000UL
+#define AVR_SPI_CLOCK       (ISA_SPI_CLOCK < (AVR_CPU_CLOCK / 2) ? ISA_SPI_CLOCK : (AVR_CPU_CLOCK / 2))
+#define AVR_CYCLE_NS        (1000000000UL / AVR_CPU_CLOCK)
+
+ISABus::ISABus(
+    bool verbose)
+: m_verbose(verbose),
+  m_costs(getAVRCosts()),
+  m_batching(false),
+  m_writeCount(0),
+  m_readCount(0),
+  m_batchCount(0),
+  m_writeHash(FNV_OFFSET_BASIS),
+  m_pendingNanoseconds(0)
 {
+    m_time.spi = 0;
+    m_time.digitalWrite = 0;
+    m_time.delay = 0;
+    m_time.transaction = 0;
 }
 
 void ISABus::reset() const
 {
 }
 
+/*
+    The charges made here follow the steps taken by ISABus::write and
+    ISABus::read in ../ISABus.cpp (SPI version)
+*/
+
 void ISABus::write(
     uint16_t address,
     uint8_t data) const
 {
-    printf("OUT %04x, %02x\n", address, data);
+    PROFILE_SCOPE(ProfileISABusWrite);
+
+    ++ m_writeCount;
+
+    m_writeHash = (m_writeHash ^ (address & 0xff)) * FNV_PRIME;
+    m_writeHash = (m_writeHash ^ (address >> 8)) * FNV_PRIME;
+    m_writeHash = (m_writeHash ^ data) * FNV_PRIME;
+
+    if (m_verbose) {
+        printf("OUT %04x, %02x\n", address, data);
+    }
+
+    if (!m_batching) {
+        // Load pin
+        chargeDigitalWrite(1);
+        chargeTransaction(true);
+    }
+
+    // Data and address
+    chargeSPI(3);
+
+    // Latch
+    chargeDigitalWrite(2);
+
+    chargeDelay(ISA_PRE_DELAY);
+    chargeDigitalWrite(1);
+    chargeDelay(ISA_IOW_DELAY);
+    chargeDigitalWrite(1);
+    chargeDelay(ISA_POST_DELAY);
+
+    if (!m_batching) {
+        chargeTransaction(false);
+    }
+
+    advance();
 }
 
 uint8_t ISABus::read(
     uint16_t address) const
 {
-    printf("IN %04x", address);
+    ++ m_readCount;
+
+    if (m_verbose) {
+        printf("IN %04x", address);
+    }
+
+    chargeTransaction(true);
+
+    // Address
+    chargeSPI(2);
+
+    // Latch and load pin
+    chargeDigitalWrite(3);
+
+    chargeDelay(ISA_PRE_DELAY);
+    chargeDigitalWrite(1);
+    chargeDelay(ISA_IOR_DELAY);
+
+    // Load the data
+    chargeSPI(1);
+
+    chargeDigitalWrite(1);
+    chargeDelay(ISA_POST_DELAY);
+
+    // Load pin
+    chargeDigitalWrite(1);
+
+    // Shift the data in
+    chargeSPI(1);
+
+    chargeTransaction(false);
+    advance();
+
     return 0xff;
 }
+
+void ISABus::beginBatch() const
+{
+    ++ m_batchCount;
+
+    chargeDigitalWrite(1);
+    chargeTransaction(true);
+    advance();
+
+    m_batching = true;
+}
+
+void ISABus::endBatch() const
+{
+    chargeTransaction(false);
+    advance();
+
+    m_batching = false;
+}
+
+unsigned long ISABus::getWriteCount() const
+{
+    return m_writeCount;
+}
+
+unsigned long ISABus::getReadCount() const
+{
+    return m_readCount;
+}
+
+unsigned long ISABus::getBatchCount() const
+{
+    return m_batchCount;
+}
+
+uint64_t ISABus::getWriteHash() const
+{
+    return m_writeHash;
+}
+
+void ISABus::setCosts(
+    const ISABusCosts &costs)
+{
+    m_costs = costs;
+}
+
+/*
+    These are estimates, which can be refined by timing the real thing.
+    SPI.transfer polls for completion, which adds a few cycles to each byte.
+    digitalWrite has to look up the pin's port and check whether it has a
+    timer attached, which takes around 55 cycles.
+*/
+
+ISABusCosts ISABus::getAVRCosts()
+{
+    ISABusCosts costs;
+
+    costs.spiByte = ((8 * 1000000000UL) / AVR_SPI_CLOCK) + (8 * AVR_CYCLE_NS);
+    costs.digitalWrite = 55 * AVR_CYCLE_NS;
+    costs.delayMicrosecond = 1000;
+    costs.beginTransaction = 10 * AVR_CYCLE_NS;
+    costs.endTransaction = 6 * AVR_CYCLE_NS;
+
+    return costs;
+}
+
+ISABusCosts ISABus::getFreeCosts()
+{
+    ISABusCosts costs;
+
+    costs.spiByte = 0;
+    costs.digitalWrite = 0;
+    costs.delayMicrosecond = 0;
+    costs.beginTransaction = 0;
+    costs.endTransaction = 0;
+
+    return costs;
+}
+
+const ISABusTime &ISABus::getTime() const
+{
+    return m_time;
+}
+
+unsigned long long ISABus::getTotalTime() const
+{
+    return m_time.spi + m_time.digitalWrite + m_time.delay + m_time.transaction;
+}
+
+void ISABus::chargeSPI(
+    unsigned int bytes) const
+{
+    unsigned long long nanoseconds = (unsigned long long)m_costs.spiByte * bytes;
+
+    m_time.spi += nanoseconds;
+    m_pendingNanoseconds += nanoseconds;
+}
+
+void ISABus::chargeDigitalWrite(
+    unsigned int count) const
+{
+    unsigned long long nanoseconds = (unsigned long long)m_costs.digitalWrite * count;
+
+    m_time.digitalWrite += nanoseconds;
+    m_pendingNanoseconds += nanoseconds;
+}
+
+void ISABus::chargeDelay(
+    unsigned int microseconds) const
+{
+    unsigned long long nanoseconds = (unsigned long long)m_costs.delayMicrosecond * microseconds;
+
+    m_time.delay += nanoseconds;
+    m_pendingNanoseconds += nanoseconds;
+}
+
+void ISABus::chargeTransaction(
+    bool begin) const
+{
+    unsigned long long nanoseconds = begin ? m_costs.beginTransaction : m_costs.endTransaction;
+
+    m_time.transaction += nanoseconds;
+    m_pendingNanoseconds += nanoseconds;
+}
+
+void ISABus::advance() const
+{
+    if (m_pendingNanoseconds >= 1000) {
+        advanceClock(m_pendingNanoseconds / 1000);
+        m_pendingNanoseconds %= 1000;
+    }
+}
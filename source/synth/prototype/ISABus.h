@@ -11,9 +11,28 @@
 
 #include <stdint.h>
 
+// Time taken by each of the operations the real ISA bus code performs, in
+// nanoseconds
+typedef struct ISABusCosts {
+    unsigned long spiByte;
+    unsigned long digitalWrite;
+    unsigned long delayMicrosecond;     // per microsecond of delayMicroseconds
+    unsigned long beginTransaction;
+    unsigned long endTransaction;
+} ISABusCosts;
+
+// Time charged so far, in nanoseconds, by type of operation
+typedef struct ISABusTime {
+    unsigned long long spi;
+    unsigned long long digitalWrite;
+    unsigned long long delay;
+    unsigned long long transaction;
+} ISABusTime;
+
 class ISABus {
     public:
-        ISABus();
+        ISABus(
+            bool verbose = true);
 
         void reset() const;
 
@@ -24,7 +43,63 @@ class ISABus {
         uint8_t read(
             uint16_t address) const;
 
+        void beginBatch() const;
+
+        void endBatch() const;
+
+        unsigned long getWriteCount() const;
+
+        unsigned long getReadCount() const;
+
+        unsigned long getBatchCount() const;
+
+        uint64_t getWriteHash() const;
+
+        // Costs for a 16MHz ATmega328, which are used unless changed here.
+        // Use getFreeCosts() to stop the bus from taking any time.
+        void setCosts(
+            const ISABusCosts &costs);
+
+        static ISABusCosts getAVRCosts();
+
+        static ISABusCosts getFreeCosts();
+
+        const ISABusTime &getTime() const;
+
+        unsigned long long getTotalTime() const;
+
     private:
+        void chargeSPI(
+            unsigned int bytes) const;
+
+        void chargeDigitalWrite(
+            unsigned int count) const;
+
+        void chargeDelay(
+            unsigned int microseconds) const;
+
+        void chargeTransaction(
+            bool begin) const;
+
+        // Pass the time charged on to the simulated clock
+        void advance() const;
+
+        bool m_verbose;
+
+        ISABusCosts m_costs;
+
+        mutable bool m_batching;
+
+        mutable unsigned long m_writeCount;
+        mutable unsigned long m_readCount;
+        mutable unsigned long m_batchCount;
+        mutable uint64_t m_writeHash;
+
+        mutable ISABusTime m_time;
+
+        // Time charged but not yet passed on to the simulated clock, which
+        // only has microsecond resolution
+        mutable unsigned long long m_pendingNanoseconds;
 };
 
 #endif
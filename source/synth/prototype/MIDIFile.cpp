@@ -0,0 +1,306 @@
+/*
+    Project:    Canyon
+    Purpose:    Standard MIDI File reader (for prototyping embedded code)
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+*/
+
+#include <stdio.h>
+#include <algorithm>
+
+#include "MIDIFile.h"
+
+#define DEFAULT_TEMPO   500000  // microseconds per quarter note (120 BPM)
+
+static uint32_t readBigEndian(
+    const uint8_t *data,
+    uint8_t length)
+{
+    uint32_t value = 0;
+
+    for (uint8_t i = 0; i < length; ++ i) {
+        value = (value << 8) | data[i];
+    }
+
+    return value;
+}
+
+// Returns false if the value runs past the end of the data
+static bool readVariableLength(
+    const uint8_t *data,
+    unsigned long length,
+    unsigned long &position,
+    unsigned long &value)
+{
+    value = 0;
+
+    for (int i = 0; i < 4; ++ i) {
+        if (position >= length) {
+            return false;
+        }
+
+        value = (value << 7) | (data[position] & 0x7f);
+
+        if (!(data[position ++] & 0x80)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+MIDIFile::MIDIFile()
+: m_duration(0),
+  m_format(0),
+  m_trackCount(0),
+  m_division(0)
+{
+}
+
+bool MIDIFile::load(
+    const char *path)
+{
+    std::vector<uint8_t> file;
+    std::vector<TrackEvent> trackEvents;
+    unsigned long position;
+    unsigned long chunkLength;
+    uint8_t buffer[4096];
+    size_t count;
+    FILE *input;
+
+    m_events.clear();
+    m_duration = 0;
+
+    input = fopen(path, "rb");
+    if (!input) {
+        return false;
+    }
+
+    while ((count = fread(buffer, 1, sizeof(buffer), input)) > 0) {
+        file.insert(file.end(), buffer, buffer + count);
+    }
+
+    fclose(input);
+
+    if ((file.size() < 14) || (readBigEndian(&file[0], 4) != 0x4d546864)) {
+        // No "MThd"
+        return false;
+    }
+
+    chunkLength = readBigEndian(&file[4], 4);
+    if (chunkLength < 6) {
+        return false;
+    }
+
+    m_format = readBigEndian(&file[8], 2);
+    m_trackCount = readBigEndian(&file[10], 2);
+    m_division = readBigEndian(&file[12], 2);
+
+    if ((m_format > 1) || (m_division == 0)) {
+        return false;
+    }
+
+    position = 8 + chunkLength;
+
+    while (position + 8 <= file.size()) {
+        chunkLength = readBigEndian(&file[position + 4], 4);
+
+        if (position + 8 + chunkLength > file.size()) {
+            // Truncated - use what there is
+            chunkLength = file.size() - position - 8;
+        }
+
+        if (readBigEndian(&file[position], 4) == 0x4d54726b) {
+            // "MTrk"
+            if (!readTrack(&file[position + 8], chunkLength, trackEvents)) {
+                return false;
+            }
+        }
+
+        position += 8 + chunkLength;
+    }
+
+    std::stable_sort(trackEvents.begin(), trackEvents.end(), isEarlier);
+
+    // Convert ticks to microseconds, one tempo segment at a time so that
+    // rounding errors don't accumulate
+    unsigned long long segmentTime = 0;
+    unsigned long segmentTicks = 0;
+    unsigned long tempo = DEFAULT_TEMPO;
+    unsigned long long ticksPerSecond = 0;
+
+    if (m_division & 0x8000) {
+        // SMPTE: frames per second (negative) and ticks per frame
+        int framesPerSecond = -(int8_t)(m_division >> 8);
+        ticksPerSecond = framesPerSecond * (m_division & 0xff);
+    }
+
+    for (size_t i = 0; i < trackEvents.size(); ++ i) {
+        const TrackEvent &trackEvent = trackEvents[i];
+        unsigned long long time;
+
+        if (ticksPerSecond) {
+            time = (trackEvent.ticks * 1000000ULL) / ticksPerSecond;
+        } else {
+            time = segmentTime
+                 + ((unsigned long long)(trackEvent.ticks - segmentTicks) * tempo) / m_division;
+        }
+
+        if (trackEvent.tempo) {
+            segmentTime = time;
+            segmentTicks = trackEvent.ticks;
+            tempo = trackEvent.tempo;
+        } else if (trackEvent.message.status < 0xf0) {
+            MIDIFileEvent event;
+
+            event.time = time;
+            event.message = trackEvent.message;
+            m_events.push_back(event);
+        }
+
+        m_duration = time;
+    }
+
+    return true;
+}
+
+bool MIDIFile::readTrack(
+    const uint8_t *data,
+    unsigned long length,
+    std::vector<TrackEvent> &events)
+{
+    unsigned long position = 0;
+    unsigned long ticks = 0;
+    unsigned long delta;
+    unsigned long metaLength;
+    uint8_t runningStatus = 0;
+    uint8_t status;
+    uint8_t dataLength;
+    TrackEvent event;
+
+    while (position < length) {
+        if (!readVariableLength(data, length, position, delta)) {
+            return false;
+        }
+
+        ticks += delta;
+
+        if (position >= length) {
+            return false;
+        }
+
+        event.ticks = ticks;
+        event.order = events.size();
+        event.tempo = 0;
+        event.message.status = 0;
+        event.message.data[0] = 0;
+        event.message.data[1] = 0;
+
+        if (data[position] & 0x80) {
+            status = data[position ++];
+        } else if (runningStatus) {
+            status = runningStatus;
+        } else {
+            return false;
+        }
+
+        if ((status == 0xf0) || (status == 0xf7)) {
+            // SysEx - skip it
+            runningStatus = 0;
+
+            if (!readVariableLength(data, length, position, metaLength)) {
+                return false;
+            }
+
+            position += metaLength;
+            continue;
+        }
+
+        if (status == 0xff) {
+            runningStatus = 0;
+
+            if (position >= length) {
+                return false;
+            }
+
+            uint8_t type = data[position ++];
+
+            if (!readVariableLength(data, length, position, metaLength)
+                || (position + metaLength > length)) {
+                return false;
+            }
+
+            event.message.status = 0xff;
+
+            if ((type == 0x51) && (metaLength == 3)) {
+                event.tempo = readBigEndian(&data[position], 3);
+            }
+
+            // Meta events are kept so tempo changes and the end of the track
+            // are placed correctly
+            events.push_back(event);
+
+            if (type == 0x2f) {
+                // End of track
+                break;
+            }
+
+            position += metaLength;
+            continue;
+        }
+
+        if (status >= 0xf0) {
+            // Not valid in a file
+            return false;
+        }
+
+        runningStatus = status;
+        dataLength = getExpectedMidiMessageLength(status) - 1;
+
+        if (position + dataLength > length) {
+            return false;
+        }
+
+        event.message.status = status;
+
+        for (uint8_t i = 0; i < dataLength; ++ i) {
+            event.message.data[i] = data[position ++] & 0x7f;
+        }
+
+        events.push_back(event);
+    }
+
+    return true;
+}
+
+bool MIDIFile::isEarlier(
+    const TrackEvent &a,
+    const TrackEvent &b)
+{
+    if (a.ticks != b.ticks) {
+        return a.ticks < b.ticks;
+    }
+
+    return a.order < b.order;
+}
+
+const std::vector<MIDIFileEvent> &MIDIFile::getEvents() const
+{
+    return m_events;
+}
+
+unsigned long long MIDIFile::getDuration() const
+{
+    return m_duration;
+}
+
+uint16_t MIDIFile::getFormat() const
+{
+    return m_format;
+}
+
+uint16_t MIDIFile::getTrackCount() const
+{
+    return m_trackCount;
+}
@@ -0,0 +1,67 @@
+/*
+    Project:    Canyon
+    Purpose:    Standard MIDI File reader (for prototyping embedded code)
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    Loads a type 0 or type 1 SMF and flattens all of its tracks into a single
+    list of channel messages, ordered by time. Tempo changes are applied while
+    loading, so each event carries an absolute time in microseconds. SysEx and
+    other meta events are dropped.
+*/
+
+#ifndef CANYON_MIDIFILE_H
+#define CANYON_MIDIFILE_H 1
+
+#include <stdint.h>
+#include <vector>
+
+#include "../MIDI.h"
+
+typedef struct MIDIFileEvent {
+    unsigned long long time;    // in microseconds
+    struct MIDIMessage message;
+} MIDIFileEvent;
+
+class MIDIFile {
+    public:
+        MIDIFile();
+
+        bool load(
+            const char *path);
+
+        const std::vector<MIDIFileEvent> &getEvents() const;
+
+        // Time of the last event (including meta events), in microseconds
+        unsigned long long getDuration() const;
+
+        uint16_t getFormat() const;
+
+        uint16_t getTrackCount() const;
+
+    private:
+        typedef struct TrackEvent {
+            unsigned long ticks;
+            unsigned long order;        // keeps simultaneous events stable
+            unsigned long tempo;        // non-zero for tempo changes
+            struct MIDIMessage message;
+        } TrackEvent;
+
+        bool readTrack(
+            const uint8_t *data,
+            unsigned long length,
+            std::vector<TrackEvent> &events);
+
+        static bool isEarlier(
+            const TrackEvent &a,
+            const TrackEvent &b);
+
+        std::vector<MIDIFileEvent> m_events;
+        unsigned long long m_duration;
+        uint16_t m_format;
+        uint16_t m_trackCount;
+        uint16_t m_division;
+};
+
+#endif
@@ -0,0 +1,39 @@
+/*
+    Project:    Canyon
+    Purpose:    Simulated Arduino timing (for prototyping embedded code)
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+*/
+
+#include "Timing.h"
+
+static thread_local unsigned long long g_clockMicros = 0;
+
+unsigned long millis()
+{
+    return (unsigned long)(g_clockMicros / 1000);
+}
+
+unsigned long micros()
+{
+    return (unsigned long)g_clockMicros;
+}
+
+void delay(
+    unsigned long ms)
+{
+    g_clockMicros += (unsigned long long)ms * 1000;
+}
+
+void delayMicroseconds(
+    unsigned int us)
+{
+    g_clockMicros += us;
+}
+
+void advanceClock(
+    unsigned long microseconds)
+{
+    g_clockMicros += microseconds;
+}
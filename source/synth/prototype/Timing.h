@@ -0,0 +1,33 @@
+/*
+    Project:    Canyon
+    Purpose:    Simulated Arduino timing (for prototyping embedded code)
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    There is no real time source when running on the host. Instead, time only
+    moves forward when the host program calls advanceClock() (or when code
+    under test calls delay/delayMicroseconds), so simulations can run as fast
+    as the host allows while still seeing sensible millis() values.
+
+    Each thread has its own clock, so several simulations can run side by side
+    (see smfbatch.cpp).
+*/
+
+#ifndef CANYON_SIMULATED_TIMING_H
+#define CANYON_SIMULATED_TIMING_H 1
+
+unsigned long millis();
+
+unsigned long micros();
+
+void delay(
+    unsigned long ms);
+
+void delayMicroseconds(
+    unsigned int us);
+
+void advanceClock(
+    unsigned long microseconds);
+
+#endif
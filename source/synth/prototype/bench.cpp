@@ -0,0 +1,474 @@
+/*
+    Project:    Canyon
+    Purpose:    Micro-benchmarks for the synth hot paths (host)
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    Runs MIDIControl, MIDIBuffer and getNoteFrequency through a set of fixed
+    scenarios and reports the host time and the number of ISA bus writes per
+    operation. An operation is one call into the code under test (including
+    calls to MIDIControl::service).
+
+    Host timings are only useful for comparing one build against another on
+    the same machine. Bus writes per operation are exact, and are the better
+    guide to how the device will behave. The time the simulated ISA bus
+    charges for those writes (see prototype/ISABus.cpp) is also shown, as a
+    prediction of the time per operation on the device.
+
+    Results can be appended to a CSV file to track them over time. When this
+    is done, the change since the last recorded result for each scenario is
+    also shown.
+
+    Usage:  bench [-o history.csv] [-l label] [scenario...]
+
+    Build from source/synth with:
+
+    g++ -O2 -I. -DCANYON_HOST_TOOL -o bench prototype/bench.cpp
+        prototype/ISABus.cpp prototype/Timing.cpp MIDI.cpp MIDIBuffer.cpp
+        MIDIControl.cpp OPL3Hardware.cpp OPL3RegisterLog.cpp freq.cpp
+        level.cpp bank.cpp Profiler.cpp PatchStore.cpp
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <chrono>
+#include <map>
+#include <string>
+
+#include "../ISABus.h"
+#include "../OPL3Hardware.h"
+#include "../MIDIControl.h"
+#include "../MIDIBuffer.h"
+#include "../freq.h"
+#include "Timing.h"
+
+// Each scenario is repeated until it has run for at least this long
+#define MINIMUM_RUN_NANOSECONDS     200000000ULL
+
+typedef struct Synth {
+    Synth()
+    : isaBus(false), opl3(isaBus, 0x388), midiControl(opl3)
+    {
+        opl3.init();
+        midiControl.init();
+    }
+
+    ISABus isaBus;
+    OPL3::Hardware opl3;
+    MIDIControl midiControl;
+} Synth;
+
+typedef struct Scenario {
+    const char *name;
+    const char *description;
+
+    // Runs the scenario once, returning the number of operations
+    unsigned long (*run)(Synth &synth);
+} Scenario;
+
+typedef struct Result {
+    double nanosecondsPerOperation;
+    double writesPerOperation;
+    double busMicrosecondsPerOperation;
+} Result;
+
+// Simple LCG, so every run produces the same sequence
+static uint32_t randomState;
+
+static uint8_t getRandom(
+    uint8_t range)
+{
+    randomState = (randomState * 1103515245) + 12345;
+    return (randomState >> 16) % range;
+}
+
+// Advance the simulated clock by 1ms and call service(), as loop() would
+static void tick(
+    Synth &synth)
+{
+    advanceClock(1000);
+    synth.midiControl.service();
+}
+
+static void holdChord(
+    Synth &synth,
+    uint8_t channel)
+{
+    for (uint8_t i = 0; i < OPL3::NumberOfChannels; ++ i) {
+        synth.midiControl.playNote(channel, 36 + (i * 3), 100);
+    }
+}
+
+static unsigned long runChord18(
+    Synth &synth)
+{
+    unsigned long operations = 0;
+
+    for (int repeat = 0; repeat < 16; ++ repeat) {
+        holdChord(synth, 0);
+        operations += OPL3::NumberOfChannels;
+
+        for (uint8_t i = 0; i < OPL3::NumberOfChannels; ++ i) {
+            synth.midiControl.stopNote(0, 36 + (i * 3));
+            ++ operations;
+        }
+
+        // Let the release phase finish so the channels are freed
+        for (int ms = 0; ms < 400; ++ ms) {
+            tick(synth);
+            ++ operations;
+        }
+    }
+
+    return operations;
+}
+
+static unsigned long runGM16(
+    Synth &synth)
+{
+    unsigned long operations = 0;
+    uint8_t notes[NUMBER_OF_MIDI_CHANNELS];
+
+    randomState = 1;
+    memset(notes, 0, sizeof(notes));
+
+    // Roughly 16 events per ms across all channels, mostly notes
+    for (int ms = 0; ms < 1000; ++ ms) {
+        for (uint8_t channel = 0; channel < NUMBER_OF_MIDI_CHANNELS; ++ channel) {
+            switch (getRandom(8)) {
+                case 0:
+                case 1:
+                case 2:
+                    if (notes[channel]) {
+                        synth.midiControl.stopNote(channel, notes[channel]);
+                    }
+                    notes[channel] = 24 + getRandom(72);
+                    synth.midiControl.playNote(channel, notes[channel], 32 + getRandom(96));
+                    operations += 2;
+                    break;
+
+                case 3:
+                    synth.midiControl.setController(channel, 7, getRandom(128));
+                    ++ operations;
+                    break;
+
+                case 4:
+                    synth.midiControl.setController(channel, 10, getRandom(128));
+                    ++ operations;
+                    break;
+
+                case 5:
+                    synth.midiControl.setPitchBend(channel, getRandom(128) << 7);
+                    ++ operations;
+                    break;
+
+                default:
+                    break;
+            };
+        }
+
+        tick(synth);
+        ++ operations;
+    }
+
+    for (uint8_t channel = 0; channel < NUMBER_OF_MIDI_CHANNELS; ++ channel) {
+        synth.midiControl.setController(channel, 120, 0);
+        ++ operations;
+    }
+
+    return operations;
+}
+
+static unsigned long runCCSweep(
+    Synth &synth)
+{
+    unsigned long operations = 0;
+
+    holdChord(synth, 0);
+
+    // One controller change per ms, as from a fader or mod wheel
+    for (int ms = 0; ms < 1024; ++ ms) {
+        synth.midiControl.setController(0, 7, (ms >> 2) & 0x7f);
+        tick(synth);
+        operations += 2;
+    }
+
+    synth.midiControl.setController(0, 120, 0);
+
+    return operations;
+}
+
+static unsigned long runKnobBurst(
+    Synth &synth)
+{
+    unsigned long operations = 0;
+
+    holdChord(synth, 0);
+
+    // A front panel knob being turned sends several values of the same
+    // controller (here, operator 1 attack rate) between service() calls
+    for (int ms = 0; ms < 256; ++ ms) {
+        for (int i = 0; i < 8; ++ i) {
+            synth.midiControl.setController(0, 86, ((ms * 8) + i) & 0x7f);
+            ++ operations;
+        }
+
+        tick(synth);
+        ++ operations;
+    }
+
+    synth.midiControl.setController(0, 120, 0);
+
+    return operations;
+}
+
+static unsigned long runPitchBendStorm(
+    Synth &synth)
+{
+    unsigned long operations = 0;
+
+    holdChord(synth, 0);
+
+    // Pitch bends arriving back to back, without service() in between
+    for (int i = 0; i < 1024; ++ i) {
+        synth.midiControl.setPitchBend(0, (i * 16) & 0x3fff);
+        ++ operations;
+    }
+
+    synth.midiControl.setController(0, 120, 0);
+
+    return operations;
+}
+
+static unsigned long runService(
+    Synth &synth)
+{
+    unsigned long operations = 0;
+
+    // LFO delayed by 150ms
+    synth.midiControl.setController(0, 12, 8);
+    synth.midiControl.setController(0, 28, 127);
+    holdChord(synth, 0);
+
+    for (int ms = 0; ms < 1000; ++ ms) {
+        tick(synth);
+        ++ operations;
+    }
+
+    synth.midiControl.setController(0, 120, 0);
+    synth.midiControl.setController(0, 28, 0);
+    synth.midiControl.setController(0, 12, 0);
+
+    return operations;
+}
+
+// These don't need the synth, but take it to fit the Scenario table
+static unsigned long runMIDIBuffer(
+    Synth &)
+{
+    static MIDIBuffer midiBuffer;
+    MIDIMessage message;
+    unsigned long operations = 0;
+
+    for (int i = 0; i < 1024; ++ i) {
+        message.status = (i & 4) ? 0x90 : 0xb0;
+        message.data[0] = i & 0x7f;
+        message.data[1] = (i >> 3) & 0x7f;
+
+        midiBuffer.put(message);
+        midiBuffer.get(message);
+        operations += 2;
+    }
+
+    return operations;
+}
+
+// Stops the compiler from optimising the frequency lookups away
+static volatile uint32_t frequencySink;
+
+static unsigned long runNoteFrequency(
+    Synth &)
+{
+    unsigned long operations = 0;
+
+    for (uint8_t note = 0; note < 128; ++ note) {
+        for (int16_t cents = -200; cents <= 200; cents += 25) {
+            frequencySink = getNoteFrequency(note, cents);
+            ++ operations;
+        }
+    }
+
+    return operations;
+}
+
+static const Scenario scenarios[] = {
+    {"chord18",     "18-note chords on and off",                runChord18},
+    {"gm16",        "Dense passage on all 16 channels",         runGM16},
+    {"ccsweep",     "CC7 sweep at 1kHz over 18 notes",          runCCSweep},
+    {"knobburst",   "8 attack rate CCs per ms over 18 notes",   runKnobBurst},
+    {"bendstorm",   "Back to back pitch bends over 18 notes",   runPitchBendStorm},
+    {"service",     "service() with 18 notes and LFO delay",    runService},
+    {"midibuffer",  "MIDIBuffer put and get",                   runMIDIBuffer},
+    {"frequency",   "getNoteFrequency",                         runNoteFrequency},
+};
+
+#define NUMBER_OF_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static Result measure(
+    const Scenario &scenario)
+{
+    Synth synth;
+    unsigned long long elapsed = 0;
+    unsigned long operations = 0;
+    unsigned long writeCount;
+    unsigned long long busTime;
+    Result result;
+
+    // Bus writes are the same for every run, so only the first is counted
+    writeCount = synth.isaBus.getWriteCount();
+    busTime = synth.isaBus.getTotalTime();
+    operations = scenario.run(synth);
+    result.writesPerOperation = (double)(synth.isaBus.getWriteCount() - writeCount) / operations;
+    result.busMicrosecondsPerOperation = (synth.isaBus.getTotalTime() - busTime) / (operations * 1000.0);
+
+    operations = 0;
+
+    while (elapsed < MINIMUM_RUN_NANOSECONDS) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        operations += scenario.run(synth);
+        elapsed += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+
+    result.nanosecondsPerOperation = (double)elapsed / operations;
+
+    return result;
+}
+
+/*
+    Read the most recent result for each scenario from the history file
+*/
+
+static void readHistory(
+    const char *path,
+    std::map<std::string, Result> &history)
+{
+    char line[256];
+    char scenario[64];
+    Result result;
+    FILE *file = fopen(path, "r");
+
+    if (!file) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        // date,label,scenario,ns/op,writes/op[,AVR us/op]
+        const char *field = strchr(line, ',');
+        if (field) {
+            field = strchr(field + 1, ',');
+        }
+
+        if (field && (sscanf(field + 1, "%63[^,],%lf,%lf", scenario,
+                             &result.nanosecondsPerOperation,
+                             &result.writesPerOperation) == 3)) {
+            history[scenario] = result;
+        }
+    }
+
+    fclose(file);
+}
+
+int main(
+    int argc,
+    char **argv)
+{
+    const char *historyPath = NULL;
+    const char *label = "";
+    std::map<std::string, Result> history;
+    bool selected[NUMBER_OF_SCENARIOS];
+    bool anySelected = false;
+    FILE *historyFile = NULL;
+    char date[32];
+    time_t now = time(NULL);
+
+    memset(selected, 0, sizeof(selected));
+
+    for (int i = 1; i < argc; ++ i) {
+        if ((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)) {
+            historyPath = argv[++ i];
+        } else if ((strcmp(argv[i], "-l") == 0) && (i + 1 < argc)) {
+            label = argv[++ i];
+        } else {
+            bool found = false;
+
+            for (size_t s = 0; s < NUMBER_OF_SCENARIOS; ++ s) {
+                if (strcmp(argv[i], scenarios[s].name) == 0) {
+                    selected[s] = true;
+                    anySelected = found = true;
+                }
+            }
+
+            if (!found) {
+                fprintf(stderr, "Usage: %s [-o history.csv] [-l label] [scenario...]\n\nScenarios:\n", argv[0]);
+
+                for (size_t s = 0; s < NUMBER_OF_SCENARIOS; ++ s) {
+                    fprintf(stderr, "    %-12s %s\n", scenarios[s].name, scenarios[s].description);
+                }
+
+                return 1;
+            }
+        }
+    }
+
+    if (historyPath) {
+        readHistory(historyPath, history);
+
+        historyFile = fopen(historyPath, "a");
+        if (!historyFile) {
+            fprintf(stderr, "Unable to open %s\n", historyPath);
+            return 1;
+        }
+    }
+
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+    printf("%-12s %12s %12s %12s %10s %10s\n", "Scenario", "ns/op", "writes/op", "AVR us/op", "ns change", "writes chg");
+
+    for (size_t s = 0; s < NUMBER_OF_SCENARIOS; ++ s) {
+        if (anySelected && !selected[s]) {
+            continue;
+        }
+
+        Result result = measure(scenarios[s]);
+
+        printf("%-12s %12.1f %12.2f %12.1f", scenarios[s].name,
+               result.nanosecondsPerOperation, result.writesPerOperation,
+               result.busMicrosecondsPerOperation);
+
+        std::map<std::string, Result>::const_iterator previous = history.find(scenarios[s].name);
+        if (previous != history.end()) {
+            printf(" %+9.1f%% %+10.2f",
+                   ((result.nanosecondsPerOperation / previous->second.nanosecondsPerOperation) - 1.0) * 100.0,
+                   result.writesPerOperation - previous->second.writesPerOperation);
+        }
+
+        printf("\n");
+
+        if (historyFile) {
+            fprintf(historyFile, "%s,%s,%s,%.1f,%.2f,%.1f\n", date, label,
+                    scenarios[s].name, result.nanosecondsPerOperation,
+                    result.writesPerOperation, result.busMicrosecondsPerOperation);
+        }
+    }
+
+    if (historyFile) {
+        fclose(historyFile);
+    }
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+    Project:    Canyon
+    Purpose:    Register log player (host)
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    Plays a DRO, VGM or IMF file through OPL3::RegisterPlayer against the
+    simulated ISA bus, as fast as possible, and reports how the register
+    writes were batched. The writes can also be captured to a DRO file, which
+    is a handy way of converting VGM/IMF files for comparison.
+
+    Usage:  regplay [-v] [-700] [-o output.dro] file
+
+    -v      Display every ISA bus access
+    -700    IMF files are 700Hz (Wolfenstein 3D) rather than 560Hz
+
+    Build from source/synth with:
+
+    g++ -I. -o regplay prototype/regplay.cpp prototype/ISABus.cpp
+        prototype/Timing.cpp OPL3Hardware.cpp OPL3RegisterLog.cpp
+        OPL3RegisterPlayer.cpp Profiler.cpp
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../ISABus.h"
+#include "../OPL3Hardware.h"
+#include "../OPL3RegisterLog.h"
+#include "../OPL3RegisterPlayer.h"
+#include "Timing.h"
+
+int main(
+    int argc,
+    char **argv)
+{
+    const char *inputPath = NULL;
+    const char *outputPath = NULL;
+    bool verbose = false;
+    bool imf700 = false;
+    OPL3::RegisterLogFormat format;
+    char signature[8];
+    unsigned long startMillis;
+    FILE *input;
+    int data;
+
+    for (int i = 1; i < argc; ++ i) {
+        if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else if (strcmp(argv[i], "-700") == 0) {
+            imf700 = true;
+        } else if ((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)) {
+            outputPath = argv[++ i];
+        } else {
+            inputPath = argv[i];
+        }
+    }
+
+    if (!inputPath) {
+        fprintf(stderr, "Usage: %s [-v] [-700] [-o output.dro] file\n", argv[0]);
+        return 1;
+    }
+
+    input = fopen(inputPath, "rb");
+    if (!input) {
+        fprintf(stderr, "Unable to open %s\n", inputPath);
+        return 1;
+    }
+
+    memset(signature, 0, sizeof(signature));
+    fread(signature, 1, sizeof(signature), input);
+    rewind(input);
+
+    if (memcmp(signature, "DBRAWOPL", 8) == 0) {
+        format = OPL3::DROFormat;
+    } else if (memcmp(signature, "Vgm ", 4) == 0) {
+        format = OPL3::VGMFormat;
+    } else {
+        format = imf700 ? OPL3::IMF700Format : OPL3::IMFFormat;
+    }
+
+    ISABus isaBus(verbose);
+    OPL3::Hardware opl3(isaBus, 0x388);
+    OPL3::RegisterLog registerLog;
+    OPL3::RegisterPlayer player(opl3);
+
+    if (outputPath) {
+        if (!registerLog.open(outputPath)) {
+            fprintf(stderr, "Unable to create %s\n", outputPath);
+            return 1;
+        }
+
+        opl3.setRegisterLog(&registerLog);
+    }
+
+    opl3.init();
+
+    // The writes made by init() aren't part of the log
+    unsigned long initWrites = isaBus.getWriteCount();
+    unsigned long initBatches = isaBus.getBatchCount();
+
+    startMillis = millis();
+    player.begin(format);
+
+    while ((data = fgetc(input)) != EOF) {
+        while (!player.put(data)) {
+            player.service();
+            advanceClock(1000);
+        }
+    }
+
+    player.end();
+
+    while (player.isPlaying()) {
+        player.service();
+        advanceClock(1000);
+    }
+
+    fclose(input);
+    registerLog.close();
+
+    printf("Duration:        %lu ms\n", millis() - startMillis);
+    unsigned long writes = isaBus.getWriteCount() - initWrites;
+    unsigned long batches = isaBus.getBatchCount() - initBatches;
+
+    printf("Register writes: %lu\n", writes / 2);
+    printf("Batches:         %lu\n", batches);
+
+    if (batches > 0) {
+        printf("Writes/batch:    %.2f\n", (writes / 2.0) / batches);
+    }
+
+    return 0;
+}
@@ -0,0 +1,263 @@
+/*
+    Project:    Canyon
+    Purpose:    Batch MIDI file renderer (host)
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    Renders every MIDI file in a directory (or a list of files) in the same
+    way as smfplay, spread across a pool of worker threads. Each file gets
+    its own simulated ISA bus, OPL3::Hardware and MIDIControl, and each thread
+    has its own simulated clock, so the results are the same however many
+    threads are used.
+
+    One line is output per file, in name order:
+
+        <register writes> <voice steals> <dropped notes> <stream hash> <file>
+
+    Comparing this output before and after a firmware change shows which files
+    the change affected.
+
+    Usage:  smfbatch [-j threads] directory|file...
+
+    Build from source/synth with:
+
+    g++ -I. -DCANYON_HOST_TOOL -pthread -o smfbatch prototype/smfbatch.cpp
+        prototype/MIDIFile.cpp prototype/ISABus.cpp prototype/Timing.cpp
+        MIDI.cpp MIDIControl.cpp OPL3Hardware.cpp OPL3RegisterLog.cpp freq.cpp
+        level.cpp bank.cpp Profiler.cpp PatchStore.cpp
+*/
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../ISABus.h"
+#include "../OPL3Hardware.h"
+#include "../MIDIControl.h"
+#include "MIDIFile.h"
+#include "Timing.h"
+
+// Time allowed after the last event for notes to be released (as smfplay)
+#define RELEASE_TAIL_MILLIS     2000
+
+typedef struct RenderResult {
+    bool loaded;
+    unsigned long registerWrites;
+    unsigned int voiceSteals;
+    unsigned int droppedNotes;
+    uint64_t hash;
+    unsigned long long duration;
+} RenderResult;
+
+/*
+    As serviceMidiInput() in canyon.ino
+*/
+
+static void dispatch(
+    MIDIControl &midiControl,
+    const struct MIDIMessage &message)
+{
+    uint8_t channel = message.status & 0x0f;
+
+    switch (message.status & 0xf0) {
+        case 0x80:
+            midiControl.stopNote(channel, message.data[0]);
+            break;
+
+        case 0x90:
+            midiControl.playNote(channel, message.data[0], message.data[1]);
+            break;
+
+        case 0xb0:
+            midiControl.setController(channel, message.data[0], message.data[1]);
+            break;
+
+        case 0xc0:
+            midiControl.setProgram(channel, message.data[0]);
+            break;
+
+        case 0xe0:
+            midiControl.setPitchBend(channel, (uint16_t)(message.data[1] << 7) | message.data[0]);
+            break;
+    };
+}
+
+static void runUntil(
+    MIDIControl &midiControl,
+    unsigned long long time)
+{
+    unsigned long long next;
+
+    while (micros() < time) {
+        next = ((micros() / 1000) + 1) * 1000;
+
+        if (next > time) {
+            advanceClock(time - micros());
+            break;
+        }
+
+        advanceClock(next - micros());
+        midiControl.service();
+    }
+}
+
+static void render(
+    const std::string &path,
+    RenderResult &result)
+{
+    MIDIFile midiFile;
+
+    result.loaded = midiFile.load(path.c_str());
+    if (!result.loaded) {
+        return;
+    }
+
+    // The clock carries on from any previous file rendered by this thread
+    unsigned long long startTime = micros();
+    const std::vector<MIDIFileEvent> &events = midiFile.getEvents();
+
+    ISABus isaBus(false);
+    OPL3::Hardware opl3(isaBus, 0x388);
+    MIDIControl midiControl(opl3);
+
+    opl3.init();
+    midiControl.init();
+
+    for (size_t i = 0; i < events.size(); ++ i) {
+        runUntil(midiControl, startTime + events[i].time);
+        dispatch(midiControl, events[i].message);
+    }
+
+    runUntil(midiControl, startTime + midiFile.getDuration() + (RELEASE_TAIL_MILLIS * 1000ULL));
+
+    result.registerWrites = isaBus.getWriteCount() / 2;
+    result.voiceSteals = midiControl.getVoiceStealCount();
+    result.droppedNotes = midiControl.getDroppedNoteCount();
+    result.hash = isaBus.getWriteHash();
+    result.duration = midiFile.getDuration();
+}
+
+static bool isMIDIFileName(
+    const char *name)
+{
+    const char *extension = strrchr(name, '.');
+
+    return extension && ((strcasecmp(extension, ".mid") == 0)
+                         || (strcasecmp(extension, ".midi") == 0)
+                         || (strcasecmp(extension, ".smf") == 0));
+}
+
+static void addPath(
+    const char *path,
+    std::vector<std::string> &paths)
+{
+    DIR *directory = opendir(path);
+    struct dirent *entry;
+
+    if (!directory) {
+        paths.push_back(path);
+        return;
+    }
+
+    while ((entry = readdir(directory)) != NULL) {
+        if (isMIDIFileName(entry->d_name)) {
+            paths.push_back(std::string(path) + "/" + entry->d_name);
+        }
+    }
+
+    closedir(directory);
+}
+
+int main(
+    int argc,
+    char **argv)
+{
+    std::vector<std::string> paths;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> nextPath(0);
+    unsigned int threadCount = std::thread::hardware_concurrency();
+    unsigned long long totalDuration = 0;
+    unsigned long totalWrites = 0;
+    unsigned long totalSteals = 0;
+    unsigned int failures = 0;
+
+    for (int i = 1; i < argc; ++ i) {
+        if ((strcmp(argv[i], "-j") == 0) && (i + 1 < argc)) {
+            threadCount = atoi(argv[++ i]);
+        } else if ((strncmp(argv[i], "-j", 2) == 0) && argv[i][2]) {
+            threadCount = atoi(&argv[i][2]);
+        } else {
+            addPath(argv[i], paths);
+        }
+    }
+
+    if (paths.empty()) {
+        fprintf(stderr, "Usage: %s [-j threads] directory|file...\n", argv[0]);
+        return 1;
+    }
+
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+
+    if (threadCount > paths.size()) {
+        threadCount = paths.size();
+    }
+
+    std::sort(paths.begin(), paths.end());
+
+    std::vector<RenderResult> results(paths.size());
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    for (unsigned int i = 0; i < threadCount; ++ i) {
+        workers.push_back(std::thread([&]() {
+            size_t index;
+
+            while ((index = nextPath ++) < paths.size()) {
+                render(paths[index], results[index]);
+            }
+        }));
+    }
+
+    for (size_t i = 0; i < workers.size(); ++ i) {
+        workers[i].join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+    for (size_t i = 0; i < paths.size(); ++ i) {
+        const RenderResult &result = results[i];
+
+        if (!result.loaded) {
+            printf("%8s %6s %6s %16s %s\n", "-", "-", "-", "failed", paths[i].c_str());
+            ++ failures;
+            continue;
+        }
+
+        printf("%8lu %6u %6u %016" PRIx64 " %s\n",
+               result.registerWrites, result.voiceSteals, result.droppedNotes,
+               result.hash, paths[i].c_str());
+
+        totalWrites += result.registerWrites;
+        totalSteals += result.voiceSteals;
+        totalDuration += result.duration;
+    }
+
+    fprintf(stderr, "%lu files (%u failed), %lu register writes, %lu voice steals\n",
+            (unsigned long)paths.size(), failures, totalWrites, totalSteals);
+    fprintf(stderr, "%.1f s of MIDI rendered in %.3f s using %u threads\n",
+            totalDuration / 1000000.0, elapsed.count(), threadCount);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,312 @@
+/*
+    Project:    Canyon
+    Purpose:    Standard MIDI File player (host)
+    Author:     Andrew Greenwood
+    License:    See license.txt
+    Date:       October 2026
+
+    Plays a type 0 or type 1 MIDI file through the real MIDIControl and
+    OPL3::Hardware code, against the simulated ISA bus. Time is simulated, so
+    a file is rendered as fast as the host can manage while the firmware still
+    sees the same millis() values it would on the device. MIDIControl::service
+    is called once per simulated millisecond, as loop() does.
+
+    Each MIDI event is listed with its time (in ms), the number of ISA bus
+    writes it caused, how long it took to handle and its latency (both in
+    microseconds). Writes made by service() are listed separately. The totals
+    at the end give a repeatable measure of the work a file causes.
+
+    The simulated ISA bus charges the time the device would take for each
+    access, so an event can be delayed by the ones before it. The latency is
+    measured from the event's time in the file until it has been handled.
+
+    Usage:  smfplay [-r] [-q] [-f] [-o output.dro] file
+
+    -r      Also display the ISA bus writes, ahead of the event that made them
+    -q      Only display the totals
+    -f      ISA bus accesses take no time
+
+    Build from source/synth with:
+
+    g++ -I. -DCANYON_HOST_TOOL -o smfplay prototype/smfplay.cpp
+        prototype/MIDIFile.cpp prototype/ISABus.cpp prototype/Timing.cpp
+        MIDI.cpp MIDIControl.cpp OPL3Hardware.cpp OPL3RegisterLog.cpp freq.cpp
+        level.cpp bank.cpp Profiler.cpp PatchStore.cpp
+
+    If WITH_PROFILER is defined in Profiler.h, the time taken by each of the
+    profiled functions is also displayed (in simulated AVR cycles).
+
+    Add -DMAX_OPL3_CHIPS=2 to spread the notes across a second OPL3 at 0x38c
+    (which isn't included in the -o output).
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../ISABus.h"
+#include "../OPL3Hardware.h"
+#include "../OPL3RegisterLog.h"
+#include "../MIDIControl.h"
+#include "../Profiler.h"
+#include "MIDIFile.h"
+#include "Timing.h"
+
+// Time allowed after the last event for notes to be released
+#define RELEASE_TAIL_MILLIS     2000
+
+static bool quiet = false;
+
+/*
+    As serviceMidiInput() in canyon.ino
+*/
+
+static void dispatch(
+    MIDIControl &midiControl,
+    const struct MIDIMessage &message)
+{
+    uint8_t channel = message.status & 0x0f;
+
+    switch (message.status & 0xf0) {
+        case 0x80:
+            midiControl.stopNote(channel, message.data[0]);
+            break;
+
+        case 0x90:
+            midiControl.playNote(channel, message.data[0], message.data[1]);
+            break;
+
+        case 0xb0:
+            midiControl.setController(channel, message.data[0], message.data[1]);
+            break;
+
+        case 0xc0:
+            midiControl.setProgram(channel, message.data[0]);
+            break;
+
+        case 0xe0:
+            midiControl.setPitchBend(channel, (uint16_t)(message.data[1] << 7) | message.data[0]);
+            break;
+    };
+}
+
+/*
+    Advance the simulated clock to the given time, calling service() at each
+    millisecond boundary. Returns the number of bus writes service() made.
+*/
+
+static unsigned long runUntil(
+    MIDIControl &midiControl,
+    const ISABus &isaBus,
+    unsigned long long time)
+{
+    unsigned long startWriteCount = isaBus.getWriteCount();
+    unsigned long writeCount;
+    unsigned long long next;
+
+    while (micros() < time) {
+        next = ((micros() / 1000) + 1) * 1000;
+
+        if (next > time) {
+            advanceClock(time - micros());
+            break;
+        }
+
+        advanceClock(next - micros());
+
+        writeCount = isaBus.getWriteCount();
+        midiControl.service();
+
+        if ((!quiet) && (isaBus.getWriteCount() != writeCount)) {
+            printf("%10.3f  service   %4lu\n",
+                   micros() / 1000.0, isaBus.getWriteCount() - writeCount);
+        }
+    }
+
+    return isaBus.getWriteCount() - startWriteCount;
+}
+
+int main(
+    int argc,
+    char **argv)
+{
+    const char *inputPath = NULL;
+    const char *outputPath = NULL;
+    bool showWrites = false;
+    bool freeBus = false;
+    unsigned long writeCount;
+    unsigned long eventWriteCount;
+    unsigned long eventWriteTotal = 0;
+    unsigned long serviceWriteTotal = 0;
+    unsigned long maxEventWriteCount = 0;
+    unsigned long initWriteCount;
+    unsigned long long handledTime;
+    unsigned long eventMicros;
+    unsigned long latency;
+    unsigned long maxNoteOnLatency = 0;
+    unsigned long long noteOnLatencyTotal = 0;
+    unsigned long noteOnCount = 0;
+    clock_t startClock;
+    double elapsedSeconds;
+
+    for (int i = 1; i < argc; ++ i) {
+        if (strcmp(argv[i], "-r") == 0) {
+            showWrites = true;
+        } else if (strcmp(argv[i], "-q") == 0) {
+            quiet = true;
+        } else if (strcmp(argv[i], "-f") == 0) {
+            freeBus = true;
+        } else if ((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)) {
+            outputPath = argv[++ i];
+        } else {
+            inputPath = argv[i];
+        }
+    }
+
+    if (!inputPath) {
+        fprintf(stderr, "Usage: %s [-r] [-q] [-f] [-o output.dro] file\n", argv[0]);
+        return 1;
+    }
+
+    MIDIFile midiFile;
+
+    if (!midiFile.load(inputPath)) {
+        fprintf(stderr, "Unable to load %s\n", inputPath);
+        return 1;
+    }
+
+    const std::vector<MIDIFileEvent> &events = midiFile.getEvents();
+
+    ISABus isaBus(showWrites && !quiet);
+    OPL3::Hardware opl3(isaBus, 0x388);
+    OPL3::RegisterLog registerLog;
+    MIDIControl midiControl(opl3);
+
+#if MAX_OPL3_CHIPS > 1
+    OPL3::Hardware secondOpl3(isaBus, 0x38c);
+    midiControl.addChip(secondOpl3);
+#endif
+
+    if (freeBus) {
+        isaBus.setCosts(ISABus::getFreeCosts());
+    }
+
+    if (outputPath) {
+        if (!registerLog.open(outputPath)) {
+            fprintf(stderr, "Unable to create %s\n", outputPath);
+            return 1;
+        }
+
+        opl3.setRegisterLog(&registerLog);
+    }
+
+    startClock = clock();
+
+    opl3.init();
+#if MAX_OPL3_CHIPS > 1
+    secondOpl3.init();
+#endif
+    midiControl.init();
+
+    initWriteCount = isaBus.getWriteCount();
+
+    for (size_t i = 0; i < events.size(); ++ i) {
+        const MIDIFileEvent &event = events[i];
+
+        serviceWriteTotal += runUntil(midiControl, isaBus, event.time);
+
+        writeCount = isaBus.getWriteCount();
+        handledTime = micros();
+        dispatch(midiControl, event.message);
+        eventWriteCount = isaBus.getWriteCount() - writeCount;
+        eventMicros = micros() - handledTime;
+        latency = micros() - event.time;
+
+        if (((event.message.status & 0xf0) == 0x90) && (event.message.data[1] > 0)) {
+            noteOnLatencyTotal += latency;
+            ++ noteOnCount;
+
+            if (latency > maxNoteOnLatency) {
+                maxNoteOnLatency = latency;
+            }
+        }
+
+        eventWriteTotal += eventWriteCount;
+        if (eventWriteCount > maxEventWriteCount) {
+            maxEventWriteCount = eventWriteCount;
+        }
+
+        if (!quiet) {
+            printf("%10.3f  %02x %02x %02x  %4lu %6lu %6lu\n",
+                   event.time / 1000.0, event.message.status,
+                   event.message.data[0], event.message.data[1],
+                   eventWriteCount, eventMicros, latency);
+        }
+    }
+
+    serviceWriteTotal += runUntil(midiControl, isaBus,
+                                  midiFile.getDuration() + (RELEASE_TAIL_MILLIS * 1000ULL));
+
+    elapsedSeconds = (double)(clock() - startClock) / CLOCKS_PER_SEC;
+
+    registerLog.close();
+
+    // Each register write is two bus writes (register then data)
+    printf("\n");
+    printf("File:                %s (type %u, %u tracks)\n",
+           inputPath, midiFile.getFormat(), midiFile.getTrackCount());
+    printf("Duration:            %.3f s\n", midiFile.getDuration() / 1000000.0);
+    printf("MIDI events:         %lu\n", (unsigned long)events.size());
+    printf("Register writes:     %lu (init %lu, events %lu, service %lu)\n",
+           isaBus.getWriteCount() / 2, initWriteCount / 2,
+           eventWriteTotal / 2, serviceWriteTotal / 2);
+    printf("Peak bus writes:     %lu\n", maxEventWriteCount);
+    printf("Voice steals:        %u\n", midiControl.getVoiceStealCount());
+    printf("Dropped notes:       %u\n", midiControl.getDroppedNoteCount());
+    printf("Stream hash:         %016" PRIx64 "\n", isaBus.getWriteHash());
+
+    if (noteOnCount > 0) {
+        printf("Note on latency:     %.1f us average, %lu us max\n",
+               (double)noteOnLatencyTotal / noteOnCount, maxNoteOnLatency);
+    }
+
+    if (isaBus.getTotalTime() > 0) {
+        const ISABusTime &busTime = isaBus.getTime();
+        double total = isaBus.getTotalTime();
+
+        printf("ISA bus time:        %.3f s (delays %.0f%%, digitalWrite %.0f%%, SPI %.0f%%, transactions %.0f%%)\n",
+               total / 1000000000.0, (busTime.delay * 100.0) / total,
+               (busTime.digitalWrite * 100.0) / total, (busTime.spi * 100.0) / total,
+               (busTime.transaction * 100.0) / total);
+    }
+
+#ifdef WITH_PROFILER
+    static const char *profileNames[NumberOfProfilePoints] = {
+        "playNote", "stopNote", "setController", "service",
+        "updateAttenuation", "setFrequency", "ISABus::write"
+    };
+
+    printf("\n%-18s %10s %14s %12s %10s\n", "Function", "Calls", "Total cycles",
+           "Avg cycles", "Max cycles");
+
+    for (int i = 0; i < NumberOfProfilePoints; ++ i) {
+        ProfilePoint point = (ProfilePoint)i;
+        uint32_t calls = getProfileCallCount(point);
+
+        printf("%-18s %10u %14u %12u %10u\n", profileNames[i], calls,
+               getProfileTotalCycles(point),
+               calls ? getProfileTotalCycles(point) / calls : 0,
+               getProfileMaxCycles(point));
+    }
+
+    printf("\n");
+#endif
+
+    if (elapsedSeconds > 0) {
+        printf("Rendered in:         %.3f s (%.0fx real time)\n", elapsedSeconds,
+               (midiFile.getDuration() / 1000000.0) / elapsedSeconds);
+    }
+
+    return 0;
+}